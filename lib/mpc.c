@@ -81,7 +81,8 @@ typedef struct {
   char *filename;
   mpc_state_t state;
 
-  char *string;
+  const char *string;
+  size_t length;
   char *buffer;
   FILE *file;
 
@@ -100,35 +101,7 @@ typedef struct {
 
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
-
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_STRING;
-
-  i->state = mpc_state_new();
-
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
-  i->file = NULL;
-
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
-
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
-
-  return i;
-}
-
+/* Strings are read in place, so they must outlive the parse */
 static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -139,9 +112,8 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->state = mpc_state_new();
 
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
   i->file = NULL;
 
@@ -160,6 +132,10 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
 }
 
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_nstring(filename, string, strlen(string));
+}
+
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -220,7 +196,6 @@ static void mpc_input_delete(mpc_input_t *i) {
 
   free(i->filename);
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
 
   free(i->marks);
@@ -367,13 +342,17 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
   return i->buffer[i->state.pos - i->marks[0].pos];
 }
 
+static char mpc_input_string_get(mpc_input_t *i) {
+  return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
+}
+
 static char mpc_input_getc(mpc_input_t *i) {
 
   char c = '\0';
 
   switch (i->type) {
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return mpc_input_string_get(i);
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
 
@@ -396,7 +375,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return mpc_input_string_get(i);
     case MPC_INPUT_FILE:
 
       c = fgetc(i->file);
@@ -601,9 +580,7 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+static const char *mpc_err_char_unescape(char c, char char_unescape_buffer[4]) {
 
   char_unescape_buffer[0] = '\'';
   char_unescape_buffer[1] = ' ';
@@ -633,6 +610,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int pos = 0;
   int max = 1023;
   char *buffer = calloc(1, 1024);
+  char char_unescape_buffer[4];
 
   if (x->failure) {
     mpc_err_string_cat(buffer, &pos, &max,
@@ -657,7 +635,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
 
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->received));
+  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->received, char_unescape_buffer));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
 
   return realloc(buffer, strlen(buffer) + 1);
@@ -2894,18 +2872,30 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 
 void mpc_ast_delete(mpc_ast_t *a) {
 
-  int i;
+  int i, num = 0, max = 0;
+  mpc_ast_t **stk = NULL;
 
-  if (a == NULL) { return; }
+  /* Children wait on an explicit stack so deep trees can't overflow the C stack */
+  while (a != NULL) {
 
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+    if (num + a->children_num > max) {
+      max = (num + a->children_num) * 2;
+      stk = realloc(stk, sizeof(mpc_ast_t*) * max);
+    }
+
+    for (i = 0; i < a->children_num; i++) {
+      if (a->children[i] != NULL) { stk[num++] = a->children[i]; }
+    }
+
+    free(a->children);
+    free(a->tag);
+    free(a->contents);
+    free(a);
+
+    a = num > 0 ? stk[--num] : NULL;
   }
 
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  free(stk);
 
 }
 
@@ -0,0 +1,496 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bignum.h"
+
+// Multiplies where the shorter side has fewer limbs than this are done the
+// schoolbook way, which beats Karatsuba's bookkeeping at small sizes
+#define KARATSUBA_CUTOFF 32
+
+// Magnitudes
+//
+// Plain limb arrays with explicit lengths, which may carry leading zeros.
+// Results are written to caller provided space.
+static int mag_trim(const uint32_t* a, int n) {
+  while (n > 0 && a[n - 1] == 0) { n--; }
+  return n;
+}
+
+static int mag_cmp(const uint32_t* a, int la, const uint32_t* b, int lb) {
+  la = mag_trim(a, la);
+  lb = mag_trim(b, lb);
+  if (la != lb) { return la < lb ? -1 : 1; }
+  for (int i = la - 1; i >= 0; i--) {
+    if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+// r = a + b, where r has room for max(la, lb) + 1 limbs. Returns r's length.
+static int mag_add(const uint32_t* a, int la, const uint32_t* b, int lb, uint32_t* r) {
+  if (la < lb) {
+    const uint32_t* t = a; a = b; b = t;
+    int n = la; la = lb; lb = n;
+  }
+
+  uint64_t carry = 0;
+  int i = 0;
+  for (; i < lb; i++) {
+    carry += (uint64_t)a[i] + b[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; i < la; i++) {
+    carry += a[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  r[la] = (uint32_t)carry;
+  return mag_trim(r, la + 1);
+}
+
+// r = a - b, where a >= b and r has room for la limbs. Returns r's length.
+static int mag_sub(const uint32_t* a, int la, const uint32_t* b, int lb, uint32_t* r) {
+  uint64_t borrow = 0;
+  int i = 0;
+  for (; i < lb; i++) {
+    uint64_t d = (uint64_t)a[i] - b[i] - borrow;
+    r[i] = (uint32_t)d;
+    borrow = d >> 63;
+  }
+  for (; i < la; i++) {
+    uint64_t d = (uint64_t)a[i] - borrow;
+    r[i] = (uint32_t)d;
+    borrow = d >> 63;
+  }
+  return mag_trim(r, la);
+}
+
+// r += a, carrying at most up to r's rn limbs
+static void mag_add_into(uint32_t* r, int rn, const uint32_t* a, int la) {
+  uint64_t carry = 0;
+  la = mag_trim(a, la);
+  for (int i = 0; i < rn && (i < la || carry); i++) {
+    carry += (uint64_t)r[i] + (i < la ? a[i] : 0);
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+// r -= a, where r >= a
+static void mag_sub_into(uint32_t* r, int rn, const uint32_t* a, int la) {
+  uint64_t borrow = 0;
+  la = mag_trim(a, la);
+  for (int i = 0; i < rn && (i < la || borrow); i++) {
+    uint64_t d = (uint64_t)r[i] - (i < la ? a[i] : 0) - borrow;
+    r[i] = (uint32_t)d;
+    borrow = d >> 63;
+  }
+}
+
+static void mag_mul_school(const uint32_t* a, int la, const uint32_t* b, int lb, uint32_t* r) {
+  for (int i = 0; i < la; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < lb; j++) {
+      uint64_t t = (uint64_t)a[i] * b[j] + r[i + j] + carry;
+      r[i + j] = (uint32_t)t;
+      carry = t >> 32;
+    }
+    r[i + lb] = (uint32_t)carry;
+  }
+}
+
+// r = a * b, where r has room for exactly la + lb limbs
+static void mag_mul(const uint32_t* a, int la, const uint32_t* b, int lb, uint32_t* r) {
+  memset(r, 0, sizeof(uint32_t) * (la + lb));
+  la = mag_trim(a, la);
+  lb = mag_trim(b, lb);
+  if (la == 0 || lb == 0) { return; }
+
+  if (la < lb) {
+    const uint32_t* t = a; a = b; b = t;
+    int n = la; la = lb; lb = n;
+  }
+
+  if (lb < KARATSUBA_CUTOFF) {
+    mag_mul_school(a, la, b, lb, r);
+    return;
+  }
+
+  // Lopsided operands are split into slices of a the size of b, so each
+  // product is balanced
+  if (2 * lb <= la) {
+    uint32_t* t = malloc(sizeof(uint32_t) * 2 * lb);
+    for (int i = 0; i < la; i += lb) {
+      int n = la - i < lb ? la - i : lb;
+      mag_mul(a + i, n, b, lb, t);
+      mag_add_into(r + i, la + lb - i, t, n + lb);
+    }
+    free(t);
+    return;
+  }
+
+  // Karatsuba: with a = a1 B^m + a0 and b = b1 B^m + b0,
+  // a b = z2 B^2m + z1 B^m + z0, where z0 = a0 b0, z2 = a1 b1 and
+  // z1 = (a0 + a1)(b0 + b1) - z0 - z2, so three multiplies instead of four
+  int m = la / 2;
+  int la1 = la - m;
+  int lb1 = lb - m;
+  mag_mul(a, m, b, m, r);
+  mag_mul(a + m, la1, b + m, lb1, r + 2 * m);
+
+  uint32_t* sa = malloc(sizeof(uint32_t) * (la1 + 1));
+  uint32_t* sb = malloc(sizeof(uint32_t) * ((lb1 > m ? lb1 : m) + 1));
+  int lsa = mag_add(a, m, a + m, la1, sa);
+  int lsb = mag_add(b, m, b + m, lb1, sb);
+
+  uint32_t* z1 = malloc(sizeof(uint32_t) * (lsa + lsb));
+  mag_mul(sa, lsa, sb, lsb, z1);
+  mag_sub_into(z1, lsa + lsb, r, 2 * m);
+  mag_sub_into(z1, lsa + lsb, r + 2 * m, la1 + lb1);
+  mag_add_into(r + m, la + lb - m, z1, lsa + lsb);
+
+  free(sa);
+  free(sb);
+  free(z1);
+}
+
+static int mag_clz(uint32_t x) {
+  int n = 0;
+  while (!(x & 0x80000000u)) { x <<= 1; n++; }
+  return n;
+}
+
+// q = a / b and r = a % b, where b has no leading zeros. q has room for
+// la - lb + 1 limbs and r for lb. This is Knuth's algorithm D.
+static void mag_divmod(const uint32_t* a, int la, const uint32_t* b, int lb, uint32_t* q, uint32_t* r) {
+  if (lb == 1) {
+    uint64_t rem = 0;
+    for (int i = la - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | a[i];
+      q[i] = (uint32_t)(cur / b[0]);
+      rem = cur % b[0];
+    }
+    r[0] = (uint32_t)rem;
+    return;
+  }
+
+  // Normalize so the divisor's top bit is set, which keeps each estimated
+  // quotient limb within two of the real one
+  int s = mag_clz(b[lb - 1]);
+  uint32_t* vn = malloc(sizeof(uint32_t) * lb);
+  uint32_t* un = malloc(sizeof(uint32_t) * (la + 1));
+  for (int i = lb - 1; i > 0; i--) {
+    vn[i] = (uint32_t)(((uint64_t)b[i] << s) | ((uint64_t)b[i - 1] >> (32 - s)));
+  }
+  vn[0] = b[0] << s;
+  un[la] = (uint32_t)((uint64_t)a[la - 1] >> (32 - s));
+  for (int i = la - 1; i > 0; i--) {
+    un[i] = (uint32_t)(((uint64_t)a[i] << s) | ((uint64_t)a[i - 1] >> (32 - s)));
+  }
+  un[0] = a[0] << s;
+
+  for (int j = la - lb; j >= 0; j--) {
+    uint64_t num = ((uint64_t)un[j + lb] << 32) | un[j + lb - 1];
+    uint64_t qhat = num / vn[lb - 1];
+    uint64_t rhat = num % vn[lb - 1];
+    while (qhat > 0xffffffffu || qhat * vn[lb - 2] > ((rhat << 32) | un[j + lb - 2])) {
+      qhat--;
+      rhat += vn[lb - 1];
+      if (rhat > 0xffffffffu) { break; }
+    }
+
+    // Multiply and subtract
+    int64_t k = 0;
+    int64_t t;
+    for (int i = 0; i < lb; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffffu);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + lb] - k;
+    un[j + lb] = (uint32_t)t;
+
+    // Went one too far, so add back
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      uint64_t c = 0;
+      for (int i = 0; i < lb; i++) {
+        c += (uint64_t)un[i + j] + vn[i];
+        un[i + j] = (uint32_t)c;
+        c >>= 32;
+      }
+      un[j + lb] += (uint32_t)c;
+    }
+  }
+
+  for (int i = 0; i < lb - 1; i++) {
+    r[i] = (uint32_t)(((uint64_t)un[i] >> s) | ((uint64_t)un[i + 1] << (32 - s)));
+  }
+  r[lb - 1] = un[lb - 1] >> s;
+
+  free(vn);
+  free(un);
+}
+
+// Signed numbers
+static bignum_t big_alloc(int len) {
+  bignum_t r = { 0, 0, NULL };
+  if (len > 0) { r.d = malloc(sizeof(uint32_t) * len); }
+  return r;
+}
+
+// Settle r's length and sign once its limbs are written
+static bignum_t big_norm(bignum_t r, int len, int sign) {
+  r.len = mag_trim(r.d, len);
+  r.sign = r.len ? sign : 0;
+  return r;
+}
+
+void big_free(bignum_t* a) {
+  free(a->d);
+  a->d = NULL;
+  a->len = 0;
+  a->sign = 0;
+}
+
+bignum_t big_copy(bignum_t a) {
+  bignum_t r = big_alloc(a.len);
+  if (a.len) { memcpy(r.d, a.d, sizeof(uint32_t) * a.len); }
+  r.len = a.len;
+  r.sign = a.sign;
+  return r;
+}
+
+bignum_t big_from_long(long x, uint32_t buf[2]) {
+  uint64_t u = x < 0 ? (uint64_t)0 - (uint64_t)x : (uint64_t)x;
+  buf[0] = (uint32_t)u;
+  buf[1] = (uint32_t)(u >> 32);
+  bignum_t r = { 0, 0, buf };
+  return big_norm(r, 2, x < 0 ? -1 : 1);
+}
+
+int big_to_long(bignum_t a, long* out) {
+  if (a.len > 2) { return 0; }
+
+  uint64_t u = 0;
+  if (a.len > 0) { u = a.d[0]; }
+  if (a.len > 1) { u |= (uint64_t)a.d[1] << 32; }
+
+  if (a.sign >= 0) {
+    if (u > (uint64_t)LONG_MAX) { return 0; }
+    *out = (long)u;
+  } else {
+    if (u > (uint64_t)LONG_MAX + 1) { return 0; }
+    *out = -(long)(u - 1) - 1;
+  }
+  return 1;
+}
+
+// r = r * m + c, in place, where r has room for one more limb
+static int mag_mul_small(uint32_t* r, int len, uint32_t m, uint32_t c) {
+  uint64_t carry = c;
+  for (int i = 0; i < len; i++) {
+    carry += (uint64_t)r[i] * m;
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  if (carry) { r[len++] = (uint32_t)carry; }
+  return len;
+}
+
+// Decimal digits with an optional leading '-', nine digits at a time
+bignum_t big_from_str(const char* s) {
+  int sign = 1;
+  if (*s == '-') { sign = -1; s++; }
+
+  int digits = strlen(s);
+  bignum_t r = big_alloc(digits / 9 + 2);
+  int len = 0;
+
+  while (*s) {
+    uint32_t chunk = 0, scale = 1;
+    for (int i = 0; i < 9 && *s; i++, s++) {
+      chunk = chunk * 10 + (uint32_t)(*s - '0');
+      scale *= 10;
+    }
+    len = mag_mul_small(r.d, len, scale, chunk);
+  }
+
+  return big_norm(r, len, sign);
+}
+
+// Peel off nine decimal digits at a time from a scratch copy
+char* big_to_str(bignum_t a) {
+  if (a.len == 0) {
+    char* s = malloc(2);
+    strcpy(s, "0");
+    return s;
+  }
+
+  uint32_t* t = malloc(sizeof(uint32_t) * a.len);
+  memcpy(t, a.d, sizeof(uint32_t) * a.len);
+  int len = a.len;
+
+  int nchunks = 0;
+  uint32_t* chunks = malloc(sizeof(uint32_t) * (a.len * 10 / 9 + 2));
+  do {
+    uint64_t rem = 0;
+    for (int i = len - 1; i >= 0; i--) {
+      uint64_t cur = (rem << 32) | t[i];
+      t[i] = (uint32_t)(cur / 1000000000u);
+      rem = cur % 1000000000u;
+    }
+    chunks[nchunks++] = (uint32_t)rem;
+    len = mag_trim(t, len);
+  } while (len > 0);
+
+  char* s = malloc(nchunks * 9 + 2);
+  char* p = s;
+  if (a.sign < 0) { *p++ = '-'; }
+  p += sprintf(p, "%u", chunks[nchunks - 1]);
+  for (int i = nchunks - 2; i >= 0; i--) {
+    p += sprintf(p, "%09u", chunks[i]);
+  }
+
+  free(t);
+  free(chunks);
+  return s;
+}
+
+int big_cmp(bignum_t a, bignum_t b) {
+  if (a.sign != b.sign) { return a.sign < b.sign ? -1 : 1; }
+  int c = mag_cmp(a.d, a.len, b.d, b.len);
+  return a.sign < 0 ? -c : c;
+}
+
+bignum_t big_add(bignum_t a, bignum_t b) {
+  if (a.sign == 0) { return big_copy(b); }
+  if (b.sign == 0) { return big_copy(a); }
+
+  int len = (a.len > b.len ? a.len : b.len) + 1;
+  bignum_t r = big_alloc(len);
+
+  if (a.sign == b.sign) {
+    return big_norm(r, mag_add(a.d, a.len, b.d, b.len, r.d), a.sign);
+  }
+
+  // Opposite signs: take the smaller magnitude from the larger
+  if (mag_cmp(a.d, a.len, b.d, b.len) >= 0) {
+    return big_norm(r, mag_sub(a.d, a.len, b.d, b.len, r.d), a.sign);
+  }
+  return big_norm(r, mag_sub(b.d, b.len, a.d, a.len, r.d), b.sign);
+}
+
+bignum_t big_sub(bignum_t a, bignum_t b) {
+  b.sign = -b.sign;
+  return big_add(a, b);
+}
+
+bignum_t big_mul(bignum_t a, bignum_t b) {
+  if (a.sign == 0 || b.sign == 0) { return big_alloc(0); }
+
+  bignum_t r = big_alloc(a.len + b.len);
+  mag_mul(a.d, a.len, b.d, b.len, r.d);
+  return big_norm(r, a.len + b.len, a.sign * b.sign);
+}
+
+int big_divmod(bignum_t a, bignum_t b, bignum_t* q, bignum_t* r) {
+  if (b.sign == 0) { return 0; }
+
+  if (mag_cmp(a.d, a.len, b.d, b.len) < 0) {
+    *q = big_alloc(0);
+    *r = big_copy(a);
+    return 1;
+  }
+
+  *q = big_alloc(a.len - b.len + 1);
+  *r = big_alloc(b.len);
+  mag_divmod(a.d, a.len, b.d, b.len, q->d, r->d);
+  *q = big_norm(*q, a.len - b.len + 1, a.sign * b.sign);
+  *r = big_norm(*r, b.len, a.sign);
+  return 1;
+}
+
+// Exponentiation by squaring
+bignum_t big_pow(bignum_t a, unsigned long e) {
+  uint32_t one = 1;
+  bignum_t r = big_copy((bignum_t){ 1, 1, &one });
+  bignum_t base = big_copy(a);
+
+  while (e > 0) {
+    if (e & 1) {
+      bignum_t t = big_mul(r, base);
+      big_free(&r);
+      r = t;
+    }
+    e >>= 1;
+    if (e) {
+      bignum_t t = big_mul(base, base);
+      big_free(&base);
+      base = t;
+    }
+  }
+
+  big_free(&base);
+  return r;
+}
+
+bignum_t big_shl(bignum_t a, int n) {
+  int limbs = n / 32, bits = n % 32;
+  bignum_t r = big_alloc(a.len + limbs + 1);
+  if (a.len == 0) { return r; }
+
+  memset(r.d, 0, sizeof(uint32_t) * limbs);
+  uint32_t carry = 0;
+  for (int i = 0; i < a.len; i++) {
+    r.d[i + limbs] = (a.d[i] << bits) | carry;
+    carry = bits ? a.d[i] >> (32 - bits) : 0;
+  }
+  r.d[a.len + limbs] = carry;
+  return big_norm(r, a.len + limbs + 1, a.sign);
+}
+
+bignum_t big_shr(bignum_t a, int n) {
+  int limbs = n / 32, bits = n % 32;
+  if (limbs >= a.len) { return big_alloc(0); }
+
+  int len = a.len - limbs;
+  bignum_t r = big_alloc(len);
+  for (int i = 0; i < len; i++) {
+    uint32_t hi = i + limbs + 1 < a.len && bits ? a.d[i + limbs + 1] << (32 - bits) : 0;
+    r.d[i] = (a.d[i + limbs] >> bits) | hi;
+  }
+  return big_norm(r, len, a.sign);
+}
+
+int big_bits(bignum_t a) {
+  if (a.len == 0) { return 0; }
+  return a.len * 32 - mag_clz(a.d[a.len - 1]);
+}
+
+// The top 64 bits with a sticky bit for anything below them round to 53
+// bits exactly as the whole number would
+double big_to_double(bignum_t a) {
+  int bits = big_bits(a);
+  if (bits == 0) { return 0.0; }
+
+  uint64_t top = 0;
+  int shift = bits > 64 ? bits - 64 : 0;
+  for (int i = 63; i >= 0; i--) {
+    int b = shift + i;
+    if (b < bits && (a.d[b / 32] >> (b % 32)) & 1) { top |= (uint64_t)1 << i; }
+  }
+  for (int i = 0; i < shift / 32 && !(top & 1); i++) {
+    if (a.d[i]) { top |= 1; }
+  }
+  if (shift % 32 && (a.d[shift / 32] & ((1u << (shift % 32)) - 1))) { top |= 1; }
+
+  double d = ldexp((double)top, shift);
+  return a.sign < 0 ? -d : d;
+}
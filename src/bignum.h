@@ -0,0 +1,51 @@
+#ifndef FLISPY_BIGNUM_H
+#define FLISPY_BIGNUM_H
+
+#include <stdint.h>
+
+// Arbitrary precision integers
+//
+// A bignum is a sign and a magnitude of 32 bit limbs, least significant
+// first, with no leading zero limbs. Zero has sign 0 and no limbs. Every
+// function returning a bignum_t returns a freshly allocated one, which the
+// caller releases with big_free. Arguments are never modified, so a bignum
+// can be a view over limbs owned by something else.
+typedef struct bignum {
+  int sign;
+  int len;
+  uint32_t* d;
+} bignum_t;
+
+void big_free(bignum_t* a);
+bignum_t big_copy(bignum_t a);
+
+// A view of x in buf, which must outlive it
+bignum_t big_from_long(long x, uint32_t buf[2]);
+
+// Store a in out and return 1, or return 0 if it does not fit in a long
+int big_to_long(bignum_t a, long* out);
+
+bignum_t big_from_str(const char* s);
+char* big_to_str(bignum_t a);
+
+int big_cmp(bignum_t a, bignum_t b);
+bignum_t big_add(bignum_t a, bignum_t b);
+bignum_t big_sub(bignum_t a, bignum_t b);
+bignum_t big_mul(bignum_t a, bignum_t b);
+
+// Truncating division, as with C's / and %. Returns 0 if b is zero.
+int big_divmod(bignum_t a, bignum_t b, bignum_t* q, bignum_t* r);
+
+bignum_t big_pow(bignum_t a, unsigned long e);
+
+// Shifts of the magnitude, keeping the sign
+bignum_t big_shl(bignum_t a, int n);
+bignum_t big_shr(bignum_t a, int n);
+
+// Number of significant bits in the magnitude
+int big_bits(bignum_t a);
+
+// Correctly rounded to the nearest double
+double big_to_double(bignum_t a);
+
+#endif
@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bignum.h"
+#include "double.h"
+
+// 128 bit products
+typedef struct u128 {
+  uint64_t hi;
+  uint64_t lo;
+} u128_t;
+
+static u128_t mul64(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 p = (unsigned __int128)a * b;
+  u128_t r = { (uint64_t)(p >> 64), (uint64_t)p };
+#else
+  uint64_t a0 = (uint32_t)a, a1 = a >> 32;
+  uint64_t b0 = (uint32_t)b, b1 = b >> 32;
+  uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+  u128_t r = { p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32), (mid << 32) | (uint32_t)p00 };
+#endif
+  return r;
+}
+
+static int clz64(uint64_t x) {
+  int n = 0;
+  while (!(x & ((uint64_t)1 << 63))) { x <<= 1; n++; }
+  return n;
+}
+
+static double dbl_from_bits(uint64_t bits) {
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+// Power tables
+//
+// Each entry is a 128 bit number stored as {low, high}. They are worked out
+// once with bignums rather than pasted in.
+//
+// el_pow10 holds the top 128 bits of each power of ten from 10^-342 to
+// 10^308, rounded down, for reading. ryu_pow5 holds 5^i cut to 125 bits and
+// ryu_pow5_inv holds 2^k / 5^q rounded up to 125 bits, for printing.
+#define EL_MIN_EXP10 (-342)
+#define EL_MAX_EXP10 308
+#define RYU_POW5_BITS 125
+#define RYU_POW5_INV_BITS 125
+#define RYU_POW5_COUNT 326
+#define RYU_POW5_INV_COUNT 342
+
+static uint64_t el_pow10[EL_MAX_EXP10 - EL_MIN_EXP10 + 1][2];
+static uint64_t ryu_pow5[RYU_POW5_COUNT][2];
+static uint64_t ryu_pow5_inv[RYU_POW5_INV_COUNT][2];
+
+// Store a, which must fit in 128 bits, and free it
+static void dbl_table_put(uint64_t t[2], bignum_t a) {
+  uint32_t d[4] = { 0 };
+  memcpy(d, a.d, sizeof(uint32_t) * a.len);
+  t[0] = d[0] | (uint64_t)d[1] << 32;
+  t[1] = d[2] | (uint64_t)d[3] << 32;
+  big_free(&a);
+}
+
+// Shift a so it has exactly n significant bits, truncating
+static bignum_t dbl_fit(bignum_t a, int n) {
+  int bits = big_bits(a);
+  return bits > n ? big_shr(a, bits - n) : big_shl(a, n - bits);
+}
+
+void dbl_init(void) {
+  uint32_t fbuf[2], obuf[2];
+  bignum_t five = big_from_long(5, fbuf);
+  bignum_t p = big_copy(big_from_long(1, obuf));
+
+  for (int q = 0; q < RYU_POW5_INV_COUNT + 1; q++) {
+    int bits = big_bits(p);
+
+    if (q <= EL_MAX_EXP10) { dbl_table_put(el_pow10[q - EL_MIN_EXP10], dbl_fit(p, 128)); }
+    if (q < RYU_POW5_COUNT) { dbl_table_put(ryu_pow5[q], dbl_fit(p, RYU_POW5_BITS)); }
+
+    if (q < RYU_POW5_INV_COUNT) {
+      bignum_t one = big_copy(big_from_long(1, obuf));
+      bignum_t n = big_shl(one, bits - 1 + RYU_POW5_INV_BITS);
+      bignum_t quot, rem;
+      big_divmod(n, p, &quot, &rem);
+      bignum_t inv = big_add(quot, big_from_long(1, obuf));
+      dbl_table_put(ryu_pow5_inv[q], inv);
+      big_free(&one);
+      big_free(&n);
+      big_free(&quot);
+      big_free(&rem);
+    }
+
+    // 10^-q has the same top bits as 1 / 5^q
+    if (q > 0 && -q >= EL_MIN_EXP10) {
+      bignum_t one = big_copy(big_from_long(1, obuf));
+      bignum_t n = big_shl(one, 127 + bits);
+      bignum_t quot, rem;
+      big_divmod(n, p, &quot, &rem);
+      dbl_table_put(el_pow10[-q - EL_MIN_EXP10], quot);
+      big_free(&one);
+      big_free(&n);
+      big_free(&rem);
+    }
+
+    bignum_t next = big_mul(p, five);
+    big_free(&p);
+    p = next;
+  }
+  big_free(&p);
+}
+
+// Reading
+//
+// Literals with up to 19 significant digits are read into a 64 bit
+// mantissa w and a power of ten. When both are small the answer is one
+// exactly rounded multiply or divide. Otherwise the Eisel-Lemire algorithm
+// multiplies w by the 128 bit power of ten and can almost always tell the
+// correctly rounded result from the top bits. The rare literals it can't
+// decide, and ones with more digits, go to strtod.
+static const double dbl_exact_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static int dbl_eisel_lemire(uint64_t w, int q, int neg, double* out) {
+  if (q < EL_MIN_EXP10 || q > EL_MAX_EXP10) { return 0; }
+
+  int lz = clz64(w);
+  w <<= lz;
+  uint64_t exp2 = (uint64_t)(((217706 * q) >> 16) + 64 + 1023) - lz;
+
+  const uint64_t* t = el_pow10[q - EL_MIN_EXP10];
+  u128_t x = mul64(w, t[1]);
+
+  // The low bits are too close to a rounding boundary, so bring in the
+  // next 64 bits of the power
+  if ((x.hi & 0x1ff) == 0x1ff && x.lo + w < w) {
+    u128_t y = mul64(w, t[0]);
+    uint64_t hi = x.hi, lo = x.lo + y.hi;
+    if (lo < x.lo) { hi++; }
+    if ((hi & 0x1ff) == 0x1ff && lo + 1 == 0 && y.lo + w < w) { return 0; }
+    x.hi = hi;
+    x.lo = lo;
+  }
+
+  uint64_t msb = x.hi >> 63;
+  uint64_t m = x.hi >> (msb + 9);
+  exp2 -= 1 ^ msb;
+
+  // Exactly halfway between two doubles
+  if (x.lo == 0 && (x.hi & 0x1ff) == 0 && (m & 3) == 1) { return 0; }
+
+  m += m & 1;
+  m >>= 1;
+  if (m >> 53) {
+    m >>= 1;
+    exp2++;
+  }
+
+  // Subnormals, infinities and overflow are left to strtod
+  if (exp2 - 1 >= 0x7ff - 1) { return 0; }
+
+  uint64_t bits = exp2 << 52 | (m & (((uint64_t)1 << 52) - 1));
+  if (neg) { bits |= (uint64_t)1 << 63; }
+  *out = dbl_from_bits(bits);
+  return 1;
+}
+
+double dbl_from_str(const char* s) {
+  const char* p = s;
+  int neg = *p == '-';
+  if (*p == '-' || *p == '+') { p++; }
+
+  uint64_t w = 0;
+  int digits = 0, q = 0;
+
+  while (*p == '0') { p++; }
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (digits == 19) { return strtod(s, NULL); }
+    w = w * 10 + (uint64_t)(*p - '0');
+    digits++;
+  }
+  if (*p == '.') {
+    for (p++; *p >= '0' && *p <= '9'; p++) {
+      q--;
+      if (digits == 0 && *p == '0') { continue; }
+      if (digits == 19) { return strtod(s, NULL); }
+      w = w * 10 + (uint64_t)(*p - '0');
+      digits++;
+    }
+  }
+  if (*p == 'e' || *p == 'E') {
+    p++;
+    int eneg = *p == '-';
+    if (*p == '-' || *p == '+') { p++; }
+    int e = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      if (e < 100000) { e = e * 10 + (*p - '0'); }
+    }
+    q += eneg ? -e : e;
+  }
+
+  if (w == 0) { return neg ? -0.0 : 0.0; }
+
+  if (w <= ((uint64_t)1 << 53) && q >= -22 && q <= 22) {
+    double d = (double)w;
+    d = q < 0 ? d / dbl_exact_pow10[-q] : d * dbl_exact_pow10[q];
+    return neg ? -d : d;
+  }
+
+  double d;
+  if (dbl_eisel_lemire(w, q, neg, &d)) { return d; }
+  return strtod(s, NULL);
+}
+
+// Printing
+//
+// Ryu: the double and the halfway points to its neighbours are scaled by a
+// power of ten into 64 bit integers using the tables, then digits are
+// removed for as long as the bounds still differ. What is left is the
+// shortest decimal inside the interval that rounds to the double.
+static int ryu_pow5bits(int e) { return ((e * 1217359) >> 19) + 1; }
+static int ryu_log10_pow2(int e) { return (e * 78913) >> 18; }
+static int ryu_log10_pow5(int e) { return (e * 732923) >> 20; }
+
+static int ryu_pow5_factor(uint64_t v) {
+  int n = 0;
+  while (v % 5 == 0) { v /= 5; n++; }
+  return n;
+}
+
+static int ryu_multiple_of_pow5(uint64_t v, int p) { return ryu_pow5_factor(v) >= p; }
+static int ryu_multiple_of_pow2(uint64_t v, int p) { return (v & (((uint64_t)1 << p) - 1)) == 0; }
+
+// (m * mul) >> j, where the result fits in 64 bits
+static uint64_t ryu_mul_shift(uint64_t m, const uint64_t mul[2], int j) {
+  u128_t b0 = mul64(m, mul[0]);
+  u128_t b2 = mul64(m, mul[1]);
+  uint64_t lo = b2.lo + b0.hi;
+  uint64_t hi = b2.hi + (lo < b2.lo);
+  int s = j - 64;
+  if (s >= 64) { return hi >> (s - 64); }
+  if (s == 0) { return lo; }
+  return (hi << (64 - s)) | (lo >> s);
+}
+
+// Shortest digits for the double with the given raw mantissa and exponent
+// fields, as output * 10^exp
+static void ryu_d2d(uint64_t mant, int exp, uint64_t* output, int* exp10) {
+  int e2;
+  uint64_t m2;
+  if (exp == 0) {
+    e2 = 1 - 1023 - 52 - 2;
+    m2 = mant;
+  } else {
+    e2 = exp - 1023 - 52 - 2;
+    m2 = ((uint64_t)1 << 52) | mant;
+  }
+  int even = (m2 & 1) == 0;
+
+  // The interval of valid representations is [mm, mp] around mv, all scaled
+  // by 4 so the halfway points are integers
+  uint64_t mv = 4 * m2;
+  uint32_t mm_shift = mant != 0 || exp <= 1;
+
+  uint64_t vr, vp, vm;
+  int e10;
+  int vm_zeros = 0, vr_zeros = 0;
+  if (e2 >= 0) {
+    int q = ryu_log10_pow2(e2) - (e2 > 3);
+    e10 = q;
+    int k = RYU_POW5_INV_BITS + ryu_pow5bits(q) - 1;
+    int i = -e2 + q + k;
+    vr = ryu_mul_shift(4 * m2, ryu_pow5_inv[q], i);
+    vp = ryu_mul_shift(4 * m2 + 2, ryu_pow5_inv[q], i);
+    vm = ryu_mul_shift(4 * m2 - 1 - mm_shift, ryu_pow5_inv[q], i);
+    if (q <= 21) {
+      if (mv % 5 == 0) {
+        vr_zeros = ryu_multiple_of_pow5(mv, q);
+      } else if (even) {
+        vm_zeros = ryu_multiple_of_pow5(mv - 1 - mm_shift, q);
+      } else {
+        vp -= ryu_multiple_of_pow5(mv + 2, q);
+      }
+    }
+  } else {
+    int q = ryu_log10_pow5(-e2) - (-e2 > 1);
+    e10 = q + e2;
+    int i = -e2 - q;
+    int k = ryu_pow5bits(i) - RYU_POW5_BITS;
+    int j = q - k;
+    vr = ryu_mul_shift(4 * m2, ryu_pow5[i], j);
+    vp = ryu_mul_shift(4 * m2 + 2, ryu_pow5[i], j);
+    vm = ryu_mul_shift(4 * m2 - 1 - mm_shift, ryu_pow5[i], j);
+    if (q <= 1) {
+      vr_zeros = 1;
+      if (even) {
+        vm_zeros = mm_shift == 1;
+      } else {
+        vp--;
+      }
+    } else if (q < 63) {
+      vr_zeros = ryu_multiple_of_pow2(mv, q);
+    }
+  }
+
+  int removed = 0;
+  int last = 0;
+  uint64_t out;
+  if (vm_zeros || vr_zeros) {
+    // Rare case where trailing zeros decide the rounding
+    while (vp / 10 > vm / 10) {
+      vm_zeros &= vm % 10 == 0;
+      vr_zeros &= last == 0;
+      last = (int)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_zeros) {
+      while (vm % 10 == 0) {
+        vr_zeros &= last == 0;
+        last = (int)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    // Round half to even
+    if (vr_zeros && last == 5 && vr % 2 == 0) { last = 4; }
+    out = vr + ((vr == vm && (!even || !vm_zeros)) || last >= 5);
+  } else {
+    int round_up = 0;
+    if (vp / 100 > vm / 100) {
+      round_up = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      round_up = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    out = vr + (vr == vm || round_up);
+  }
+
+  *output = out;
+  *exp10 = e10 + removed;
+}
+
+// Plain notation for numbers from 1e-5 up to 1e21, scientific otherwise
+int dbl_to_str(double d, char* buf) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  int neg = bits >> 63;
+  int exp = (int)(bits >> 52) & 0x7ff;
+  uint64_t mant = bits & (((uint64_t)1 << 52) - 1);
+
+  char* p = buf;
+  if (exp == 0x7ff) {
+    strcpy(buf, mant ? "nan" : neg ? "-inf" : "inf");
+    return strlen(buf);
+  }
+  if (neg) { *p++ = '-'; }
+  if (exp == 0 && mant == 0) {
+    strcpy(p, "0.0");
+    return p - buf + 3;
+  }
+
+  uint64_t m;
+  int e10;
+  ryu_d2d(mant, exp, &m, &e10);
+
+  char digits[20];
+  int n = 0;
+  for (; m; m /= 10) { digits[19 - n++] = '0' + (char)(m % 10); }
+  char* ds = digits + 20 - n;
+
+  // Where the decimal point falls relative to the first digit
+  int point = n + e10;
+
+  if (point > 0 && point <= 21) {
+    if (point >= n) {
+      memcpy(p, ds, n);
+      p += n;
+      memset(p, '0', point - n);
+      p += point - n;
+      *p++ = '.';
+      *p++ = '0';
+    } else {
+      memcpy(p, ds, point);
+      p += point;
+      *p++ = '.';
+      memcpy(p, ds + point, n - point);
+      p += n - point;
+    }
+  } else if (point <= 0 && point > -5) {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -point);
+    p += -point;
+    memcpy(p, ds, n);
+    p += n;
+  } else {
+    *p++ = ds[0];
+    if (n > 1) {
+      *p++ = '.';
+      memcpy(p, ds + 1, n - 1);
+      p += n - 1;
+    }
+    int e = point - 1;
+    *p++ = 'e';
+    if (e < 0) {
+      *p++ = '-';
+      e = -e;
+    }
+    char eb[4];
+    int en = 0;
+    do { eb[en++] = '0' + (char)(e % 10); e /= 10; } while (e);
+    while (en) { *p++ = eb[--en]; }
+  }
+
+  *p = '\0';
+  return p - buf;
+}
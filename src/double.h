@@ -0,0 +1,19 @@
+#ifndef FLISPY_DOUBLE_H
+#define FLISPY_DOUBLE_H
+
+// Decimal conversion of doubles
+//
+// Both directions are exact: reading rounds to the nearest double, and
+// printing gives the shortest digits that read back as the same double.
+// dbl_init builds the power tables both rely on and must run first.
+void dbl_init(void);
+
+// s is a decimal literal with an optional sign, fraction and exponent
+double dbl_from_str(const char* s);
+
+// Write d to buf, which needs DBL_STR_MAX bytes, returning the length.
+// Finite values always have a '.' or an 'e', so they read back as doubles.
+#define DBL_STR_MAX 32
+int dbl_to_str(double d, char* buf);
+
+#endif
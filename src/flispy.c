@@ -0,0 +1,4517 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LARITH_X86 1
+#endif
+
+#include "../lib/mpc.h"
+#include "bignum.h"
+#include "double.h"
+#include "flispy.h"
+#include "jit.h"
+#include "mat.h"
+#include "pool.h"
+#include "vec.h"
+
+#define LMAT_ROWS(v) ((v)->ivec[-2])
+#define LMAT_COLS(v) ((v)->ivec[-1])
+
+#define LASSERT(args, cond, err) \
+  if (!(cond)) { lval_del(args); return lval_err(err); }
+
+// LVAL_PROC is the compiled body shared by every closure made from one lambda
+// and LVAL_TASK the state shared by every copy of one future
+enum {
+  LVAL_NUM, LVAL_DBL, LVAL_VEC, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_PROC,
+  LVAL_FUTURE, LVAL_TASK,
+};
+
+// Builtin IDs, in the same order as the builtins table
+enum {
+  LBUILTIN_ADD, LBUILTIN_SUB, LBUILTIN_MUL, LBUILTIN_DIV, LBUILTIN_MOD, LBUILTIN_POW,
+  LBUILTIN_LIST, LBUILTIN_HEAD, LBUILTIN_TAIL, LBUILTIN_JOIN, LBUILTIN_EVAL,
+  LBUILTIN_DEF, LBUILTIN_LAMBDA, LBUILTIN_LET, LBUILTIN_IF,
+  LBUILTIN_EQ, LBUILTIN_NE, LBUILTIN_GT, LBUILTIN_LT, LBUILTIN_GE, LBUILTIN_LE,
+  LBUILTIN_VEC, LBUILTIN_UNVEC, LBUILTIN_DOT, LBUILTIN_MIN, LBUILTIN_MAX, LBUILTIN_SCAN,
+  LBUILTIN_MATRIX, LBUILTIN_MATMUL, LBUILTIN_TRANSPOSE,
+  LBUILTIN_PMAP, LBUILTIN_PFILTER, LBUILTIN_PREDUCE,
+  LBUILTIN_FUTURE, LBUILTIN_PROMISE, LBUILTIN_AWAIT,
+  LBUILTIN_COUNT,
+  LBUILTIN_NONE = -1,
+};
+
+// Interned symbol, one per distinct name
+typedef struct lsym {
+  char* name;
+  int builtin;
+  unsigned version;  // bumped each time a global of this name is defined
+} lsym_t;
+
+// Value flags
+enum {
+  LVAL_ARENA = 1,
+  LVAL_VIEW = 2,
+  LVAL_PINNED = 4,
+  LVAL_OLD = 8,
+  LVAL_REMEMBERED = 16,
+  LVAL_FORWARD = 32,
+  LVAL_DOUBLES = 64,
+  LVAL_MATRIX = 128,
+};
+
+// Reference counts stick at this value and the value is never freed
+#define LVAL_REFS_MAX 0xffff
+
+// Lists up to this long keep their cells inside the value itself
+#define LVAL_INLINE 8
+
+// Only the member for the value's type is live. Lists point cell at buf
+// while they fit inline, and at a separate array once they outgrow it.
+// cell is the first live element, start slots into an allocation of cap,
+// so popping the front only moves the pointer. A view has no storage of its
+// own and instead points cell into the cells of its owner.
+//
+// A number too big for a long keeps its limbs in big and its length in
+// count, which is 0 for one that fits.
+//
+// A vector keeps count elements straight after its header, as longs in
+// ivec or as doubles in dvec if it is flagged LVAL_DOUBLES. Vectors never
+// change once made. A view of one points into its owner's elements.
+//
+// A matrix is a vector flagged LVAL_MATRIX, with its rows in order. The two
+// longs just before its elements hold its shape, read with LMAT_ROWS and
+// LMAT_COLS. It has at least one row and one column, since an empty one
+// would print as [] and read back as a plain vector.
+//
+// A function keeps its builtin ID in count. Lambdas have LBUILTIN_NONE there,
+// a proc holding their code and source, and the env they were made in.
+//
+// A future points at its task, which like a proc only ever lives on the
+// heap. A task running on a worker holds the worker's state, and in value
+// the expression to evaluate if the worker gives up, with count set. Once
+// resolved it drops the state and holds the future's value instead.
+typedef struct lval {
+  unsigned char type;
+  unsigned char flags;
+  unsigned short refs;
+  int count;
+  union {
+    long num;
+    double dbl;
+    struct {
+      uint32_t* big;
+      int sign;
+    };
+    char* err;
+    lsym_t* sym;
+    struct lval* task;
+    struct {
+      union {
+        struct lval** cell;
+        long* ivec;
+        double* dvec;
+      };
+      union {
+        struct {
+          int cap;
+          int start;
+        };
+        struct lval* owner;
+      };
+    };
+    struct {
+      struct lval* proc;
+      struct lval* env;
+    };
+    struct {
+      struct lcode* code;
+      struct lval* src;
+    };
+    struct {
+      struct lfuture* future;
+      struct lval* value;
+    };
+  };
+  struct lval* buf[];
+} lval_t;
+
+// Value words
+//
+// An lval_t* is a tagged word. Numbers that fit in 63 bits are stored in the
+// word itself with the low bit set, and the empty S- and Q-expressions are
+// constant words, so none of these ever touch memory. Everything else is a
+// pointer to a heap or arena lval_t.
+#define LVAL_FIX_MIN (LONG_MIN / 2)
+#define LVAL_FIX_MAX (LONG_MAX / 2)
+#define LVAL_IS_FIX(v) ((uintptr_t)(v) & 1)
+#define LVAL_IS_IMM(v) ((uintptr_t)(v) & 3)
+#define LVAL_FIX(x) ((lval_t*)(((uintptr_t)(x) << 1) | 1))
+#define LVAL_FIX_VAL(v) ((long)(intptr_t)(v) >> 1)
+#define LVAL_EMPTY(type) ((lval_t*)(((uintptr_t)(type) << 2) | 2))
+
+static inline int lval_type(lval_t* v) {
+  if (LVAL_IS_FIX(v)) { return LVAL_NUM; }
+  if (LVAL_IS_IMM(v)) { return (int)((uintptr_t)v >> 2); }
+  return v->type;
+}
+
+static inline int lval_is_big(lval_t* v) {
+  return !LVAL_IS_FIX(v) && v->count > 0;
+}
+
+static inline int lval_is_num(lval_t* v) {
+  return lval_type(v) == LVAL_NUM || lval_type(v) == LVAL_DBL;
+}
+
+// Only meaningful for numbers that are not big
+static inline long lval_long(lval_t* v) {
+  return LVAL_IS_FIX(v) ? LVAL_FIX_VAL(v) : v->num;
+}
+
+static inline int lval_count(lval_t* v) {
+  return LVAL_IS_IMM(v) ? 0 : v->count;
+}
+
+// Reference counts
+//
+// Heap and arena values are reference counted. Copying a value just takes
+// another reference, and anything that changes a value in place first makes
+// sure it holds the only one (lval_own), so the first consumer mutates and
+// the rest copy only if the value really is shared. Counts are plain
+// increments: pool workers only read the values they are handed and never
+// take or drop references.
+static lval_t* lval_retain(lval_t* v) {
+  if (v->refs != LVAL_REFS_MAX) { v->refs++; }
+  return v;
+}
+
+// Drop a reference, returning how many are left
+static int lval_release(lval_t* v) {
+  if (v->refs == LVAL_REFS_MAX) { return LVAL_REFS_MAX; }
+  return --v->refs;
+}
+
+static int lval_shared(lval_t* v) {
+  return (v->flags & LVAL_VIEW) || v->refs > 1;
+}
+
+// Forward Declarations
+void lval_print(lval_t *t);
+void lval_del(lval_t* v);
+lval_t* lval_eval(lval_t* x);
+void lcode_del(struct lcode* c);
+void lfuture_del(struct lfuture* f);
+
+// Arena
+//
+// Every value built while evaluating one line is bump allocated from a chain
+// of chunks. The whole line is released at once by rewinding to the first
+// chunk, so lval_del on an arena value does nothing. Chunks are kept and
+// reused by the next line. Arena values never hold references to the heap:
+// heap values they need are pinned once per line instead, which keeps them
+// alive until the line is released.
+#define LARENA_CHUNK (64 * 1024)
+
+typedef struct larena_chunk {
+  struct larena_chunk* next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+} larena_chunk_t;
+
+typedef struct larena {
+  larena_chunk_t* head;
+  larena_chunk_t* cur;
+  size_t allocated;
+  lval_t** pins;
+  int npins;
+  int pincap;
+} larena_t;
+
+static larena_chunk_t* larena_chunk(size_t size, larena_chunk_t* next) {
+  larena_chunk_t* c = malloc(sizeof(larena_chunk_t) + size);
+  c->next = next;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+void* larena_alloc(larena_t* a, size_t n) {
+  n = (n + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+  if (!a->cur) { a->head = a->cur = larena_chunk(n > LARENA_CHUNK ? n : LARENA_CHUNK, NULL); }
+
+  while (a->cur->used + n > a->cur->size) {
+    larena_chunk_t* next = a->cur->next;
+    if (!next || n > next->size) {
+      next = larena_chunk(n > LARENA_CHUNK ? n : LARENA_CHUNK, next);
+      a->cur->next = next;
+    }
+    next->used = 0;
+    a->cur = next;
+  }
+
+  void* p = (char*)a->cur->data + a->cur->used;
+  a->cur->used += n;
+  a->allocated += n;
+  return p;
+}
+
+void larena_pin(larena_t* a, lval_t* v) {
+  if (v->flags & LVAL_PINNED) { return; }
+
+  if (a->npins == a->pincap) {
+    a->pincap = a->pincap ? a->pincap * 2 : 16;
+    a->pins = realloc(a->pins, sizeof(lval_t*) * a->pincap);
+  }
+  v->flags |= LVAL_PINNED;
+  a->pins[a->npins++] = lval_retain(v);
+}
+
+// Start handing out memory from the first chunk again
+void larena_rewind(larena_t* a) {
+  a->cur = a->head;
+  if (a->cur) { a->cur->used = 0; }
+  a->allocated = 0;
+}
+
+void larena_free(larena_t* a) {
+  while (a->head) {
+    larena_chunk_t* next = a->head->next;
+    free(a->head);
+    a->head = next;
+  }
+  a->cur = NULL;
+  a->allocated = 0;
+}
+
+void larena_reset(larena_t* a) {
+  larena_rewind(a);
+
+  for (int i = 0; i < a->npins; i++) {
+    a->pins[i]->flags &= ~LVAL_PINNED;
+    lval_del(a->pins[i]);
+  }
+  a->npins = 0;
+}
+
+// Collector
+//
+// A line does not have to finish before its garbage is reclaimed. The arena
+// is the nursery: once more than nursery_limit bytes have been allocated in
+// it, the VM stops at its next call and copies whatever its stacks can still
+// reach into the tenured space, then rewinds the nursery. When the tenured
+// space grows past growth percent of what was live after the last full
+// collection, both spaces are copied together into a fresh tenured space
+// instead. Copies get exact reference counts as they are traced. Tenured
+// lists that have values stored into them are remembered by lval_barrier and
+// scanned as extra roots, since they may now point into the nursery.
+//
+// Heap values are never moved. Lists that die there are queued and freed at
+// most sweep_budget cells at a time, so dropping a huge list never stalls.
+typedef struct lgc {
+  larena_t old;
+  lval_t** remembered;
+  int nremembered;
+  int remcap;
+  lval_t** dead;
+  int ndead;
+  int deadcap;
+  lval_t** scan;
+  int nscan;
+  int scancap;
+
+  // Tunables
+  size_t nursery_limit;
+  size_t old_limit;
+  int growth;
+  int sweep_budget;
+
+  // Statistics for the current line
+  int stats;
+  unsigned long minor;
+  unsigned long major;
+  double pause_total;
+  double pause_max;
+  unsigned long pauses[32];
+} lgc_t;
+
+#define LGC_OLD_MIN (16 << 20)
+
+// Contexts
+//
+// Everything an interpreter owns lives in its context: the symbol table and
+// globals, the arena its lines are built in, the collector, the VM stacks
+// and the grammar. lctx is the context being run, set by each call into the
+// embedding API and put back when it returns, so a thread can hold any
+// number of contexts and a context can move between threads, as long as
+// one thread uses it at a time. What is left to the whole process is the
+// thread pool and the tables and settings set up with the first context,
+// which are only read from then on.
+//
+// The value of the last line is kept until the next one, and the line's
+// arena and tenured space with it, so it can be read where it is.
+#define LCTX_RULES 8
+
+struct flispy_ctx {
+  lsym_t** symtab;
+  size_t symtab_count;
+  size_t symtab_cap;
+
+  lsym_t** env_keys;
+  lval_t** env_vals;
+  size_t env_count;
+  size_t env_cap;
+
+  // Arena new values come from, or NULL for the heap
+  larena_t* alloc;
+  larena_t arena;
+  lgc_t gc;
+  struct lvm* vms;
+  struct {
+    unsigned long hits;
+    unsigned long misses;
+    int stats;
+  } ic;
+  unsigned fork_runs;
+
+  mpc_parser_t* rules[LCTX_RULES];
+  lval_t* result;
+};
+
+// Initial exec TLS is a plain load off the thread pointer, even from the
+// shared library, where the default model calls __tls_get_addr
+#if defined(__GNUC__) && !defined(_WIN32)
+static _Thread_local flispy_ctx_t* lctx __attribute__((tls_model("initial-exec"))) = NULL;
+#else
+static _Thread_local flispy_ctx_t* lctx = NULL;
+#endif
+
+// Symbol table
+//
+// Names are interned once at read time into an open addressing table, so a
+// symbol is a pointer to its unique entry and compares with ==.
+static size_t lsym_hash(char* s) {
+  size_t h = 14695981039346656037u;
+  while (*s) { h = (h ^ (unsigned char)*s++) * 1099511628211u; }
+  return h;
+}
+
+static void lsym_grow(void) {
+  size_t cap = lctx->symtab_cap ? lctx->symtab_cap * 2 : 64;
+  lsym_t** tab = calloc(cap, sizeof(lsym_t*));
+
+  for (size_t i = 0; i < lctx->symtab_cap; i++) {
+    if (!lctx->symtab[i]) { continue; }
+    size_t j = lsym_hash(lctx->symtab[i]->name) & (cap - 1);
+    while (tab[j]) { j = (j + 1) & (cap - 1); }
+    tab[j] = lctx->symtab[i];
+  }
+
+  free(lctx->symtab);
+  lctx->symtab = tab;
+  lctx->symtab_cap = cap;
+}
+
+lsym_t* lsym_intern(char* name) {
+  if ((lctx->symtab_count + 1) * 2 > lctx->symtab_cap) { lsym_grow(); }
+
+  size_t i = lsym_hash(name) & (lctx->symtab_cap - 1);
+  while (lctx->symtab[i]) {
+    if (strcmp(lctx->symtab[i]->name, name) == 0) { return lctx->symtab[i]; }
+    i = (i + 1) & (lctx->symtab_cap - 1);
+  }
+
+  lsym_t* s = malloc(sizeof(lsym_t));
+  s->name = malloc(strlen(name) + 1);
+  strcpy(s->name, name);
+  s->builtin = LBUILTIN_NONE;
+  s->version = 0;
+  lctx->symtab[i] = s;
+  lctx->symtab_count++;
+  return s;
+}
+
+void lsym_free(void) {
+  for (size_t i = 0; i < lctx->symtab_cap; i++) {
+    if (!lctx->symtab[i]) { continue; }
+    free(lctx->symtab[i]->name);
+    free(lctx->symtab[i]);
+  }
+  free(lctx->symtab);
+  lctx->symtab = NULL;
+  lctx->symtab_count = lctx->symtab_cap = 0;
+}
+
+static void lval_push(lval_t*** arr, int* n, int* cap, lval_t* v) {
+  if (*n == *cap) {
+    *cap = *cap ? *cap * 2 : 64;
+    *arr = realloc(*arr, sizeof(lval_t*) * *cap);
+  }
+  (*arr)[(*n)++] = v;
+}
+
+// Call after storing values into the cells of an existing list
+static void lval_barrier(lval_t* v) {
+  if ((v->flags & (LVAL_OLD | LVAL_REMEMBERED)) == LVAL_OLD) {
+    v->flags |= LVAL_REMEMBERED;
+    lval_push(&lctx->gc.remembered, &lctx->gc.nremembered, &lctx->gc.remcap, v);
+  }
+}
+
+static lval_t* lval_new(int type, size_t size) {
+  lval_t* v;
+  if (lctx->alloc) {
+    v = larena_alloc(lctx->alloc, size);
+    v->flags = LVAL_ARENA;
+  } else {
+    v = malloc(size);
+    v->flags = 0;
+  }
+  v->type = type;
+  v->refs = 1;
+  return v;
+}
+
+// Allocate storage that lives exactly as long as v
+static void* lval_mem(lval_t* v, size_t n) {
+  if (!(v->flags & LVAL_ARENA)) { return malloc(n); }
+  return larena_alloc((v->flags & LVAL_OLD) ? &lctx->gc.old : lctx->alloc, n);
+}
+
+// Make room for at least n cells from the first live one. Space freed at
+// the front is reused once it outweighs the live cells, otherwise the array
+// doubles, so appends stay amortized constant.
+static void lval_reserve(lval_t* v, int n) {
+  if (v->start + n <= v->cap) { return; }
+
+  lval_t** base = v->cell - v->start;
+
+  if (n <= v->cap && v->start >= v->count) {
+    memmove(base, v->cell, sizeof(lval_t*) * v->count);
+    v->cell = base;
+    v->start = 0;
+    return;
+  }
+
+  int cap = v->cap ? v->cap : 1;
+  while (cap < n) { cap *= 2; }
+  if (cap == v->cap) { cap *= 2; }
+
+  lval_t** cell = lval_mem(v, sizeof(lval_t*) * cap);
+  memcpy(cell, v->cell, sizeof(lval_t*) * v->count);
+  if (!(v->flags & LVAL_ARENA) && base != v->buf) { free(base); }
+  v->cell = cell;
+  v->cap = cap;
+  v->start = 0;
+}
+
+// Constructors
+lval_t* lval_num(long x) {
+  if (x >= LVAL_FIX_MIN && x <= LVAL_FIX_MAX) { return LVAL_FIX(x); }
+
+  lval_t* v = lval_new(LVAL_NUM, sizeof(lval_t));
+  v->count = 0;
+  v->num = x;
+  return v;
+}
+
+// Takes a, returning a plain number when it fits in a long
+lval_t* lval_big(bignum_t a) {
+  long x;
+  if (big_to_long(a, &x)) {
+    big_free(&a);
+    return lval_num(x);
+  }
+
+  lval_t* v = lval_new(LVAL_NUM, sizeof(lval_t));
+  v->count = a.len;
+  v->sign = a.sign;
+  v->big = lval_mem(v, sizeof(uint32_t) * a.len);
+  memcpy(v->big, a.d, sizeof(uint32_t) * a.len);
+  big_free(&a);
+  return v;
+}
+
+// A view of any number as a bignum, using buf for ones that fit in a long
+static bignum_t lval_bignum(lval_t* v, uint32_t buf[2]) {
+  if (!lval_is_big(v)) { return big_from_long(lval_long(v), buf); }
+  bignum_t a = { v->sign, v->count, v->big };
+  return a;
+}
+
+// Any number as a double, rounding integers too big to be exact
+static double lval_double(lval_t* v) {
+  if (lval_type(v) == LVAL_DBL) { return v->dbl; }
+  if (!lval_is_big(v)) { return (double)lval_long(v); }
+  uint32_t buf[2];
+  return big_to_double(lval_bignum(v, buf));
+}
+
+// Integers only, doubles are compared as doubles
+static int lval_num_cmp(lval_t* x, lval_t* y) {
+  if (!lval_is_big(x) && !lval_is_big(y)) {
+    long a = lval_long(x), b = lval_long(y);
+    return (a > b) - (a < b);
+  }
+  uint32_t xb[2], yb[2];
+  return big_cmp(lval_bignum(x, xb), lval_bignum(y, yb));
+}
+
+// Any number but zero counts as true, and a big one is never zero
+static int lval_true(lval_t* v) {
+  if (lval_type(v) == LVAL_DBL) { return v->dbl != 0; }
+  return lval_is_big(v) || lval_long(v) != 0;
+}
+
+lval_t* lval_dbl(double x) {
+  lval_t* v = lval_new(LVAL_DBL, sizeof(lval_t));
+  v->count = 0;
+  v->dbl = x;
+  return v;
+}
+
+// A vector of n elements, filled in by the caller
+lval_t* lval_vec(int n, int dbl) {
+  lval_t* v = lval_new(LVAL_VEC, sizeof(lval_t) + sizeof(long) * n);
+  if (dbl) { v->flags |= LVAL_DOUBLES; }
+  v->count = n;
+  v->ivec = (long*)v->buf;
+  return v;
+}
+
+// A rows by cols matrix, filled in by the caller
+lval_t* lval_mat(int rows, int cols, int dbl) {
+  int n = rows * cols;
+  lval_t* v = lval_new(LVAL_VEC, sizeof(lval_t) + sizeof(long) * (2 + n));
+  v->flags |= LVAL_MATRIX | (dbl ? LVAL_DOUBLES : 0);
+  v->count = n;
+  v->ivec = (long*)v->buf + 2;
+  LMAT_ROWS(v) = rows;
+  LMAT_COLS(v) = cols;
+  return v;
+}
+
+// A vector or matrix of the same shape as v
+static lval_t* lval_vec_like(lval_t* v, int dbl) {
+  if (v->flags & LVAL_MATRIX) { return lval_mat(LMAT_ROWS(v), LMAT_COLS(v), dbl); }
+  return lval_vec(v->count, dbl);
+}
+
+lval_t* lval_err(char* m) {
+  lval_t* v = lval_new(LVAL_ERR, sizeof(lval_t));
+  v->err = lval_mem(v, strlen(m) + 1);
+  strcpy(v->err, m);
+  return v;
+}
+
+lval_t* lval_sym(char* s) {
+  lval_t* v = lval_new(LVAL_SYM, sizeof(lval_t));
+  v->sym = lsym_intern(s);
+  return v;
+}
+
+lval_t* lval_sexpr(void) {
+  return LVAL_EMPTY(LVAL_SEXPR);
+}
+
+lval_t* lval_qexpr(void) {
+  return LVAL_EMPTY(LVAL_QEXPR);
+}
+
+// A list with room for n cells, used once it has something in it
+lval_t* lval_list(int type, int n) {
+  lval_t* v;
+  if (n <= LVAL_INLINE) {
+    v = lval_new(type, sizeof(lval_t) + sizeof(lval_t*) * n);
+    v->cell = v->buf;
+  } else {
+    v = lval_new(type, sizeof(lval_t));
+    v->cell = lval_mem(v, sizeof(lval_t*) * n);
+  }
+  v->count = 0;
+  v->cap = n;
+  v->start = 0;
+  return v;
+}
+
+// Views
+//
+// A slice of a shared list is a view: a window of cells in an owner list,
+// which it keeps alive. Views of views point straight at the original
+// owner, so head and tail of a shared list are O(1) however it was sliced.
+// A view is always read only; anything that changes it takes its own copy
+// first with lval_own.
+
+lval_t* lval_view(lval_t* v, int i, int n) {
+  if (n == 0 && v->type != LVAL_VEC) { return LVAL_EMPTY(v->type); }
+
+  lval_t* o = (v->flags & LVAL_VIEW) ? v->owner : v;
+  lval_t* x = lval_new(v->type, sizeof(lval_t));
+  x->flags |= LVAL_VIEW | (v->flags & (LVAL_DOUBLES | LVAL_MATRIX));
+  x->cell = v->cell + i;
+  x->count = n;
+  x->owner = o;
+
+  // An arena view of a heap list pins it for the line rather than holding it
+  if ((x->flags & LVAL_ARENA) && !(o->flags & LVAL_ARENA)) {
+    larena_pin(lctx->alloc, o);
+  } else {
+    lval_retain(o);
+  }
+  return x;
+}
+
+lval_t* lval_copy(lval_t* v);
+
+// Let go of the owner of a view we hold the only reference to, giving it a
+// cell array of its own
+static void lval_unview(lval_t* v) {
+  lval_t* o = v->owner;
+  lval_t** cell = v->cell;
+  int n = v->count;
+
+  v->flags &= ~LVAL_VIEW;
+  v->cell = lval_mem(v, sizeof(lval_t*) * n);
+  v->cap = n;
+  v->start = 0;
+  for (int i = 0; i < n; i++) {
+    v->cell[i] = lval_copy(cell[i]);
+  }
+  lval_barrier(v);
+
+  if (!(v->flags & LVAL_ARENA) || (o->flags & LVAL_ARENA)) { lval_del(o); }
+}
+
+// Return a list that can be changed in place: v itself if we hold the only
+// reference, otherwise a fresh list sharing v's cells
+lval_t* lval_own(lval_t* v) {
+  if (LVAL_IS_IMM(v)) { return v; }
+  if (!lval_shared(v)) { return v; }
+  if (v->refs == 1) { lval_unview(v); return v; }
+
+  lval_t* x = lval_list(v->type, v->count);
+  for (int i = 0; i < v->count; i++) {
+    x->cell[i] = lval_copy(v->cell[i]);
+  }
+  x->count = v->count;
+  lval_del(v);
+  return x;
+}
+
+// S- and Q-expressions share a layout, so switching between them only
+// touches the tag
+lval_t* lval_retype(lval_t* v, int type) {
+  if (LVAL_IS_IMM(v)) { return LVAL_EMPTY(type); }
+  v = lval_own(v);
+  v->type = type;
+  return v;
+}
+
+// Destructor
+void lval_del(lval_t* v) {
+  if (LVAL_IS_IMM(v) || lval_release(v) > 0) { return; }
+
+  // Arena values go with the rest of their line, but still let go of their
+  // owner so it stops counting as shared
+  if (v->flags & LVAL_ARENA) {
+    if ((v->flags & LVAL_VIEW) && (v->owner->flags & LVAL_ARENA)) { lval_del(v->owner); }
+    return;
+  }
+
+  if (v->flags & LVAL_VIEW) {
+    lval_del(v->owner);
+    free(v);
+    return;
+  }
+
+  // Lists are left for lgc_sweep to take apart
+  if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && v->count > 0) {
+    lval_push(&lctx->gc.dead, &lctx->gc.ndead, &lctx->gc.deadcap, v);
+    return;
+  }
+
+  switch(v->type) {
+    case LVAL_NUM:
+      if (v->count > 0) { free(v->big); }
+      break;
+    case LVAL_DBL:
+    case LVAL_VEC:
+      break;
+    case LVAL_ERR:
+      free(v->err);
+      break;
+    case LVAL_SYM:
+      break;
+    case LVAL_FUN:
+      lval_del(v->proc);
+      lval_del(v->env);
+      break;
+    case LVAL_PROC:
+      lcode_del(v->code);
+      lval_del(v->src);
+      break;
+    case LVAL_FUTURE:
+      lval_del(v->task);
+      break;
+    case LVAL_TASK:
+      lfuture_del(v->future);
+      lval_del(v->value);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; ++i) {
+        lval_del(v->cell[i]);
+      }
+      if (v->cell - v->start != v->buf) { free(v->cell - v->start); }
+      break;
+  }
+  free(v);
+}
+
+lval_t* lval_clone(lval_t* v);
+
+// Copy anything but a list without sharing it with the original
+static lval_t* lval_clone_atom(lval_t* v) {
+  lval_t* x = NULL;
+
+  switch(v->type) {
+    case LVAL_NUM:
+      x = lval_new(LVAL_NUM, sizeof(lval_t));
+      x->count = v->count;
+      x->num = v->num;
+      if (v->count > 0) {
+        x->big = lval_mem(x, sizeof(uint32_t) * v->count);
+        memcpy(x->big, v->big, sizeof(uint32_t) * v->count);
+        x->sign = v->sign;
+      }
+      break;
+    case LVAL_DBL:
+      x = lval_dbl(v->dbl);
+      break;
+    case LVAL_VEC:
+      x = lval_vec_like(v, v->flags & LVAL_DOUBLES);
+      memcpy(x->ivec, v->ivec, sizeof(long) * v->count);
+      break;
+    case LVAL_ERR:
+      x = lval_new(LVAL_ERR, sizeof(lval_t));
+      x->err = lval_mem(x, strlen(v->err) + 1);
+      strcpy(x->err, v->err);
+      break;
+    case LVAL_SYM:
+      x = lval_new(LVAL_SYM, sizeof(lval_t));
+      x->sym = v->sym;
+      break;
+    case LVAL_FUN:
+      // Builtins are static, and procs never change once compiled
+      if (!v->proc) { return v; }
+      x = lval_new(LVAL_FUN, sizeof(lval_t));
+      x->count = LBUILTIN_NONE;
+      x->proc = lval_copy(v->proc);
+      x->env = (lctx->alloc || LVAL_IS_IMM(v->env) || !(v->env->flags & LVAL_ARENA))
+        ? lval_copy(v->env) : lval_clone(v->env);
+      break;
+    case LVAL_PROC:
+    case LVAL_TASK:
+      return lval_copy(v);
+    case LVAL_FUTURE:
+      x = lval_new(LVAL_FUTURE, sizeof(lval_t));
+      x->task = lval_copy(v->task);
+      break;
+  }
+  return x;
+}
+
+// Copy a value without sharing anything with the original. Lists are copied
+// level by level from a worklist of (original, copy) pairs still to be
+// filled in, so nesting depth is limited only by memory.
+lval_t* lval_clone(lval_t* v) {
+  if (LVAL_IS_IMM(v)) { return v; }
+  if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) { return lval_clone_atom(v); }
+
+  lval_t* root = lval_list(v->type, v->count);
+  lval_t** work = NULL;
+  int n = 0, cap = 0;
+  lval_push(&work, &n, &cap, v);
+  lval_push(&work, &n, &cap, root);
+
+  while (n) {
+    lval_t* x = work[--n];
+    lval_t* y = work[--n];
+    for (int i = 0; i < y->count; i++) {
+      lval_t* c = y->cell[i];
+      if (LVAL_IS_IMM(c)) {
+        x->cell[i] = c;
+      } else if (c->type == LVAL_SEXPR || c->type == LVAL_QEXPR) {
+        x->cell[i] = lval_list(c->type, c->count);
+        lval_push(&work, &n, &cap, c);
+        lval_push(&work, &n, &cap, x->cell[i]);
+      } else {
+        x->cell[i] = lval_clone_atom(c);
+      }
+    }
+    x->count = y->count;
+  }
+
+  free(work);
+  return root;
+}
+
+// Copy a value by taking another reference to it
+lval_t* lval_copy(lval_t* v) {
+  if (LVAL_IS_IMM(v)) { return v; }
+
+  // Keep arena lines off the heap: lists and vectors are seen through a view
+  // of a pinned owner, procs and tasks are pinned themselves, and anything
+  // else is small enough to clone
+  if (lctx->alloc && !(v->flags & LVAL_ARENA)) {
+    if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR || v->type == LVAL_VEC) {
+      return lval_view(v, 0, v->count);
+    }
+    if (v->type == LVAL_PROC || v->type == LVAL_TASK) { larena_pin(lctx->alloc, v); return v; }
+    return lval_clone(v);
+  }
+
+  return lval_retain(v);
+}
+
+// Move a value out of the arena so it can outlive the current line
+lval_t* lval_promote(lval_t* v) {
+  if (LVAL_IS_IMM(v) || !(v->flags & LVAL_ARENA)) { return v; }
+
+  larena_t* a = lctx->alloc;
+  lctx->alloc = NULL;
+  lval_t* x = lval_clone(v);
+  lctx->alloc = a;
+  return x;
+}
+
+lval_t* lval_add(lval_t* v, lval_t* x) {
+  if (LVAL_IS_IMM(v)) { v = lval_list(lval_type(v), 1); }
+  v = lval_own(v);
+
+  lval_reserve(v, v->count + 1);
+  v->cell[v->count++] = x;
+  lval_barrier(v);
+  return v;
+}
+
+// Literals too long for a long are read as bignums
+lval_t* lval_read_num(mpc_ast_t* t) {
+  errno = 0;
+  long x = strtol(t->contents, NULL, 10);
+  return errno != ERANGE ? lval_num(x) : lval_big(big_from_str(t->contents));
+}
+
+// Brackets and the start/end of input markers are not part of the value
+int lval_read_skip(mpc_ast_t* t) {
+  if (strcmp(t->contents, "(") == 0) { return 1; }
+  if (strcmp(t->contents, ")") == 0) { return 1; }
+  if (strcmp(t->contents, "{") == 0) { return 1; }
+  if (strcmp(t->contents, "}") == 0) { return 1; }
+  if (strcmp(t->tag, "regex") == 0) { return 1; }
+  return 0;
+}
+
+// Numbers and symbols, or NULL for a node holding a list
+static lval_t* lval_read_mat(mpc_ast_t* t, int rows);
+
+// Vectors hold doubles if any element is written as one
+static lval_t* lval_read_vec(mpc_ast_t* t) {
+  int n = 0, dbl = 0, rows = 0;
+  for (int i = 0; i < t->children_num; i++) {
+    char* tag = t->children[i]->tag;
+    if (strstr(tag, "double")) { dbl = 1; }
+    if (strstr(tag, "double") || strstr(tag, "number")) { n++; }
+    if (strstr(tag, "vector")) { rows++; }
+  }
+
+  if (rows && n) { return lval_err("Matrix rows must all be vectors"); }
+  if (rows) { return lval_read_mat(t, rows); }
+
+  lval_t* v = lval_vec(n, dbl);
+  n = 0;
+  for (int i = 0; i < t->children_num; i++) {
+    mpc_ast_t* c = t->children[i];
+    if (strstr(c->tag, "double")) {
+      v->dvec[n++] = dbl_from_str(c->contents);
+    } else if (strstr(c->tag, "number")) {
+      errno = 0;
+      long x = strtol(c->contents, NULL, 10);
+      if (errno == ERANGE && !dbl) {
+        lval_del(v);
+        return lval_err("Number too big for a vector");
+      }
+      if (dbl) {
+        v->dvec[n++] = dbl_from_str(c->contents);
+      } else {
+        v->ivec[n++] = x;
+      }
+    }
+  }
+  return v;
+}
+
+// A vector of vectors is a matrix, one row each
+static lval_t* lval_read_mat(mpc_ast_t* t, int rows) {
+  lval_t** row = malloc(sizeof(lval_t*) * rows);
+  lval_t* err = NULL;
+  int n = 0, dbl = 0, cols = -1;
+  for (int i = 0; i < t->children_num; i++) {
+    if (!strstr(t->children[i]->tag, "vector")) { continue; }
+    lval_t* r = row[n++] = lval_read_vec(t->children[i]);
+    if (!err && lval_type(r) == LVAL_ERR) { err = lval_err(r->err); }
+    if (!err && (r->flags & LVAL_MATRIX)) { err = lval_err("Matrices have only two dimensions"); }
+    if (!err && cols >= 0 && r->count != cols) { err = lval_err("Matrix rows differ in length!"); }
+    if (!err && r->count == 0) { err = lval_err("Matrix rows must not be empty"); }
+    if (!err) { cols = r->count; }
+    if (!err && (r->flags & LVAL_DOUBLES)) { dbl = 1; }
+  }
+
+  lval_t* m = err;
+  if (!err) {
+    m = lval_mat(rows, cols, dbl);
+    for (int i = 0; i < rows; i++) {
+      for (int j = 0; j < cols; j++) {
+        if (dbl && !(row[i]->flags & LVAL_DOUBLES)) {
+          m->dvec[i * cols + j] = (double)row[i]->ivec[j];
+        } else {
+          m->ivec[i * cols + j] = row[i]->ivec[j];
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < n; i++) { lval_del(row[i]); }
+  free(row);
+  return m;
+}
+
+static lval_t* lval_read_atom(mpc_ast_t* t) {
+  if (strstr(t->tag, "vector")) { return lval_read_vec(t); }
+  if (strstr(t->tag, "double")) { return lval_dbl(dbl_from_str(t->contents)); }
+  if (strstr(t->tag, "number")) { return lval_read_num(t); }
+  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  return NULL;
+}
+
+// Size the list exactly, so small ones land inline
+static lval_t* lval_read_list(mpc_ast_t* t) {
+  int type = strstr(t->tag, "qexpr") ? LVAL_QEXPR : LVAL_SEXPR;
+
+  int count = 0;
+  for (int i = 0; i < t->children_num; i++) {
+    if (!lval_read_skip(t->children[i])) { count++; }
+  }
+  if (count == 0) { return LVAL_EMPTY(type); }
+
+  return lval_list(type, count);
+}
+
+// A list being read, and the next of its children to read
+typedef struct lread {
+  mpc_ast_t* t;
+  int i;
+  lval_t* x;
+} lread_t;
+
+// Lists still being filled are kept on an explicit stack rather than the C
+// stack, so nesting depth is limited only by memory
+lval_t* lval_read(mpc_ast_t* t) {
+  lval_t* x = lval_read_atom(t);
+  if (x) { return x; }
+
+  lread_t small[32];
+  lread_t* stack = small;
+  int n = 0, cap = 32;
+  stack[n++] = (lread_t){ t, 0, lval_read_list(t) };
+
+  for (;;) {
+    lread_t* top = &stack[n - 1];
+    while (top->i < top->t->children_num && lval_read_skip(top->t->children[top->i])) { top->i++; }
+
+    // Finished lists go into their parent
+    if (top->i == top->t->children_num) {
+      x = top->x;
+      if (--n == 0) { break; }
+      top = &stack[n - 1];
+      top->x->cell[top->x->count++] = x;
+      continue;
+    }
+
+    mpc_ast_t* c = top->t->children[top->i++];
+    x = lval_read_atom(c);
+    if (x) {
+      top->x->cell[top->x->count++] = x;
+      continue;
+    }
+
+    if (n == cap) {
+      cap *= 2;
+      if (stack == small) {
+        stack = malloc(sizeof(lread_t) * cap);
+        memcpy(stack, small, sizeof(small));
+      } else {
+        stack = realloc(stack, sizeof(lread_t) * cap);
+      }
+    }
+    stack[n++] = (lread_t){ c, 0, lval_read_list(c) };
+  }
+
+  if (stack != small) { free(stack); }
+  return x;
+}
+
+static void lval_print_open(lval_t* v) {
+  putchar(lval_type(v) == LVAL_QEXPR ? '{' : '(');
+}
+
+static void lval_print_close(lval_t* v) {
+  putchar(lval_type(v) == LVAL_QEXPR ? '}' : ')');
+}
+
+// Print anything but a list
+static void lval_print_atom(lval_t* t) {
+  switch(lval_type(t)) {
+    case LVAL_NUM:
+      if (lval_is_big(t)) {
+        uint32_t buf[2];
+        char* s = big_to_str(lval_bignum(t, buf));
+        fputs(s, stdout);
+        free(s);
+      } else {
+        printf("%li", lval_long(t));
+      }
+      break;
+    case LVAL_DBL: {
+      char buf[DBL_STR_MAX];
+      dbl_to_str(t->dbl, buf);
+      fputs(buf, stdout);
+      break;
+    }
+    case LVAL_VEC: {
+      char buf[DBL_STR_MAX];
+      int cols = (t->flags & LVAL_MATRIX) ? LMAT_COLS(t) : -1;
+      putchar('[');
+      for (int i = 0; i < t->count; i++) {
+        if (cols > 0 && i % cols == 0) { fputs(i ? "] [" : "[", stdout); }
+        else if (i) { putchar(' '); }
+        if (t->flags & LVAL_DOUBLES) {
+          dbl_to_str(t->dvec[i], buf);
+          fputs(buf, stdout);
+        } else {
+          printf("%li", t->ivec[i]);
+        }
+      }
+      if (cols > 0) { putchar(']'); }
+      putchar(']');
+      break;
+    }
+    case LVAL_ERR: printf("Error: %s", t->err); break;
+    case LVAL_SYM: printf("%s", t->sym->name); break;
+    case LVAL_FUN:
+      if (!t->proc) { printf("<builtin>"); break; }
+      printf("(\\ ");
+      lval_print(t->proc->src->cell[0]);
+      putchar(' ');
+      lval_print(t->proc->src->cell[1]);
+      putchar(')');
+      break;
+    case LVAL_FUTURE: printf("<future>"); break;
+  }
+}
+
+// Open lists are kept on an explicit stack along with how far through them
+// we are, so nesting depth is limited only by memory
+void lval_print(lval_t* t) {
+  int type = lval_type(t);
+  if (type != LVAL_SEXPR && type != LVAL_QEXPR) {
+    lval_print_atom(t);
+    return;
+  }
+
+  lval_t** lists = NULL;
+  int* next = NULL;
+  int n = 0, cap = 0;
+  lval_print_open(t);
+  lval_push(&lists, &n, &cap, t);
+  next = realloc(next, sizeof(int) * cap);
+  next[0] = 0;
+
+  while (n) {
+    lval_t* v = lists[n - 1];
+    if (next[n - 1] == lval_count(v)) {
+      lval_print_close(v);
+      n--;
+      continue;
+    }
+
+    if (next[n - 1] > 0) { putchar(' '); }
+    lval_t* c = v->cell[next[n - 1]++];
+    type = lval_type(c);
+    if (type != LVAL_SEXPR && type != LVAL_QEXPR) {
+      lval_print_atom(c);
+      continue;
+    }
+
+    lval_print_open(c);
+    int old = cap;
+    lval_push(&lists, &n, &cap, c);
+    if (cap != old) { next = realloc(next, sizeof(int) * cap); }
+    next[n - 1] = 0;
+  }
+
+  free(lists);
+  free(next);
+}
+
+void lval_println(lval_t* t) {
+  lval_print(t);
+  putchar('\n');
+}
+
+// x must not be shared with anyone else, see lval_own
+lval_t* lval_pop(lval_t* x, int i) {
+  if (x->flags & LVAL_VIEW) { lval_unview(x); }
+
+  lval_t* p = x->cell[i];
+
+  if (i == 0) {
+    // Step over the front item
+    x->cell++;
+    x->start++;
+  } else {
+    // Shift memory at item "i" over the top
+    memmove(&x->cell[i], &x->cell[i + 1], sizeof(lval_t*) * (x->count - i - 1));
+  }
+
+  x->count--;
+  return p;
+}
+
+// Drop everything after the first n items
+void lval_truncate(lval_t* x, int n) {
+  for (int i = n; i < x->count; i++) {
+    lval_del(x->cell[i]);
+  }
+  x->count = n;
+}
+
+lval_t* lval_take(lval_t* x, int i) {
+  // Leave a shared list alone and just take another reference to the item
+  if (lval_shared(x)) {
+    lval_t* p = lval_copy(x->cell[i]);
+    lval_del(x);
+    return p;
+  }
+
+  lval_t* p = lval_pop(x, i);
+  lval_del(x);
+  return p;
+}
+
+// Arithmetic
+//
+// Numbers are folded as longs for as long as nothing overflows. The first
+// operation that would, or the first big argument, hands the running total
+// over to bignums for the rest of the arguments, and the result drops back
+// to a long if it fits.
+static int larith_add(long a, long b, long* r) {
+#ifdef __GNUC__
+  return __builtin_add_overflow(a, b, r);
+#else
+  if ((b > 0 && a > LONG_MAX - b) || (b < 0 && a < LONG_MIN - b)) { return 1; }
+  *r = a + b;
+  return 0;
+#endif
+}
+
+static int larith_sub(long a, long b, long* r) {
+#ifdef __GNUC__
+  return __builtin_sub_overflow(a, b, r);
+#else
+  if ((b < 0 && a > LONG_MAX + b) || (b > 0 && a < LONG_MIN + b)) { return 1; }
+  *r = a - b;
+  return 0;
+#endif
+}
+
+static int larith_mul(long a, long b, long* r) {
+#ifdef __GNUC__
+  return __builtin_mul_overflow(a, b, r);
+#else
+  if (a != 0 && b != 0) {
+    if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a)
+              : (b > 0 ? a < LONG_MIN / b : a < LONG_MAX / b)) { return 1; }
+  }
+  *r = a * b;
+  return 0;
+#endif
+}
+
+// Exponentiation by squaring. A negative exponent truncates like division
+// does, so only 1 and -1 survive it.
+static int larith_pow(long a, long e, long* r, lval_t** err) {
+  if (e < 0) {
+    if (a == 0) { *err = lval_err("Division by Zero!"); return 0; }
+    *r = a == 1 ? 1 : a == -1 ? ((e & 1) ? -1 : 1) : 0;
+    return 0;
+  }
+
+  long acc = 1;
+  while (e > 0) {
+    if ((e & 1) && larith_mul(acc, a, &acc)) { return 1; }
+    e >>= 1;
+    if (e && larith_mul(a, a, &a)) { return 1; }
+  }
+  *r = acc;
+  return 0;
+}
+
+// Fold args into acc as longs, returning how many were folded before a big
+// argument or an overflow. 0 means start over from the first argument.
+static int lval_arith_long(lval_t** args, int argc, int op, long* acc, lval_t** err) {
+  *acc = 0;
+  if (argc == 0) { return 0; }
+  if (lval_is_big(args[0])) { return 0; }
+  *acc = lval_long(args[0]);
+
+  // If there is only one argument then return the inverse version of it
+  if (op == LBUILTIN_SUB && argc == 1) {
+    if (*acc == LONG_MIN) { return 0; }
+    *acc = -*acc;
+    return 1;
+  }
+
+  // While there are still arguments left perform the operation
+  for (int i = 1; i < argc; i++) {
+    if (lval_is_big(args[i])) { return i; }
+    long y = lval_long(args[i]);
+    long r = 0;
+    int overflow = 0;
+
+    switch (op) {
+      case LBUILTIN_ADD: overflow = larith_add(*acc, y, &r); break;
+      case LBUILTIN_SUB: overflow = larith_sub(*acc, y, &r); break;
+      case LBUILTIN_MUL: overflow = larith_mul(*acc, y, &r); break;
+      case LBUILTIN_POW: overflow = larith_pow(*acc, y, &r, err); break;
+      case LBUILTIN_MOD:
+      case LBUILTIN_DIV:
+        if (y == 0) {
+          *err = lval_err("Division by Zero!");
+        } else if (y == -1) {
+          overflow = op == LBUILTIN_DIV && *acc == LONG_MIN;
+          if (op == LBUILTIN_DIV && !overflow) { r = -*acc; }
+        } else {
+          r = op == LBUILTIN_DIV ? *acc / y : *acc % y;
+        }
+        break;
+    }
+
+    // acc is left as it was before the operation that overflowed
+    if (*err) { return argc; }
+    if (overflow) { return i; }
+    *acc = r;
+  }
+  return argc;
+}
+
+// Carry on from args[i] with bignums, starting from acc, or from args[0]
+// when i is 0
+static lval_t* lval_arith_big(lval_t** args, int argc, int op, int i, long acc) {
+  uint32_t buf[2];
+  bignum_t a = big_copy(i ? big_from_long(acc, buf) : lval_bignum(args[0], buf));
+  lval_t* err = NULL;
+
+  if (op == LBUILTIN_SUB && argc == 1) { a.sign = -a.sign; }
+
+  for (i = i ? i : 1; !err && i < argc; i++) {
+    bignum_t y = lval_bignum(args[i], buf);
+    bignum_t r = { 0, 0, NULL };
+    bignum_t q;
+
+    switch (op) {
+      case LBUILTIN_ADD: r = big_add(a, y); break;
+      case LBUILTIN_SUB: r = big_sub(a, y); break;
+      case LBUILTIN_MUL: r = big_mul(a, y); break;
+      case LBUILTIN_POW:
+        // Only 0, 1 and -1 can be raised past what fits in memory
+        if (y.sign == 0) {
+          r = big_copy(big_from_long(1, buf));
+        } else if (a.len == 0) {
+          if (y.sign < 0) { err = lval_err("Division by Zero!"); }
+        } else if (a.len == 1 && a.d[0] == 1) {
+          r = big_copy(a);
+          if (!(y.d[0] & 1)) { r.sign = 1; }
+        } else if (y.sign < 0) {
+          // Truncates to zero, as with longs
+        } else if (y.len > 1) {
+          err = lval_err("Exponent too large!");
+        } else {
+          r = big_pow(a, y.len ? y.d[0] : 0);
+        }
+        break;
+      case LBUILTIN_MOD:
+      case LBUILTIN_DIV:
+        if (!big_divmod(a, y, &q, &r)) {
+          err = lval_err("Division by Zero!");
+          break;
+        }
+        if (op == LBUILTIN_DIV) {
+          big_free(&r);
+          r = q;
+        } else {
+          big_free(&q);
+        }
+        break;
+    }
+
+    big_free(&a);
+    a = r;
+  }
+
+  if (err) {
+    big_free(&a);
+    return err;
+  }
+  return lval_big(a);
+}
+
+lval_t* lval_arith(lval_t** args, int argc, int op);
+
+// Any double among the arguments makes the whole operation a double one.
+// Integers ahead of the first double are added, subtracted or multiplied
+// exactly first, so (+ (+ a b) c) and (+ a b c) agree however big a and b
+// are, which lets the compiler flatten one into the other.
+static lval_t* lval_arith_dbl(lval_t** args, int argc, int op) {
+  int i = 1;
+  while (i < argc && lval_type(args[i - 1]) != LVAL_DBL && lval_type(args[i]) != LVAL_DBL) { i++; }
+
+  double acc;
+  if (i > 1 && op <= LBUILTIN_MUL) {
+    lval_t** ints = malloc(sizeof(lval_t*) * i);
+    for (int j = 0; j < i; j++) { ints[j] = lval_copy(args[j]); }
+    lval_t* r = lval_arith(ints, i, op);
+    free(ints);
+    acc = lval_double(r);
+    lval_del(r);
+  } else {
+    i = 1;
+    acc = argc ? lval_double(args[0]) : 0;
+  }
+
+  if (op == LBUILTIN_SUB && argc == 1) { acc = -acc; }
+
+  for (; i < argc; i++) {
+    double y = lval_double(args[i]);
+
+    switch (op) {
+      case LBUILTIN_ADD: acc += y; break;
+      case LBUILTIN_SUB: acc -= y; break;
+      case LBUILTIN_MUL: acc *= y; break;
+      case LBUILTIN_POW: acc = pow(acc, y); break;
+      case LBUILTIN_MOD:
+      case LBUILTIN_DIV:
+        if (y == 0) { return lval_err("Division by Zero!"); }
+        acc = op == LBUILTIN_DIV ? acc / y : fmod(acc, y);
+        break;
+    }
+  }
+  return lval_dbl(acc);
+}
+
+// Reduction kernels
+//
+// Long argument lists of nothing but fixnums skip the general path. Sums
+// are taken straight from the tagged words: with the tag bit cleared each
+// word is twice its value, so if adding those up never overflows, half the
+// total is itself a fixnum. Tags and overflow are collected with ands and
+// ors rather than branches, so the loops vectorize by hand below. Any
+// other argument, or an overflow in any lane, returns 0 and the general
+// path works out the exact answer.
+#define LARITH_KERNEL_MIN 8
+
+static int lsum_scalar(lval_t** args, int n, long* out) {
+  uintptr_t tags = 1;
+  long acc = 0, ovf = 0;
+  for (int i = 0; i < n; i++) {
+    uintptr_t w = (uintptr_t)args[i];
+    long x = (long)(w & ~(uintptr_t)1);
+    long s = (long)((unsigned long)acc + (unsigned long)x);
+    tags &= w;
+    ovf |= (acc ^ s) & (x ^ s);
+    acc = s;
+  }
+  if (!(tags & 1) || ovf < 0) { return 0; }
+  *out = acc >> 1;
+  return 1;
+}
+
+#ifdef LARITH_X86
+// Finish a vector sum by adding its lanes and the leftover words
+static int lsum_finish(long* lanes, int nlanes, long ovf, uintptr_t tags,
+    lval_t** rest, int n, long* out) {
+  long acc = 0;
+  for (int i = 0; i < nlanes; i++) {
+    long s = (long)((unsigned long)acc + (unsigned long)lanes[i]);
+    ovf |= (acc ^ s) & (lanes[i] ^ s);
+    acc = s;
+  }
+
+  long tail;
+  if (!(tags & 1) || ovf < 0 || !lsum_scalar(rest, n, &tail)) { return 0; }
+  tail *= 2;
+
+  long s = (long)((unsigned long)acc + (unsigned long)tail);
+  if (((acc ^ s) & (tail ^ s)) < 0) { return 0; }
+  *out = s >> 1;
+  return 1;
+}
+
+// SSE2 is part of x86-64, so this one needs no check
+static int lsum_sse2(lval_t** args, int n, long* out) {
+  __m128i acc = _mm_setzero_si128(), ovf = _mm_setzero_si128();
+  __m128i tags = _mm_set1_epi64x(-1), strip = _mm_set1_epi64x(~1LL);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i w = _mm_loadu_si128((const __m128i*)(args + i));
+    __m128i x = _mm_and_si128(w, strip);
+    __m128i s = _mm_add_epi64(acc, x);
+    tags = _mm_and_si128(tags, w);
+    ovf = _mm_or_si128(ovf, _mm_and_si128(_mm_xor_si128(acc, s), _mm_xor_si128(x, s)));
+    acc = s;
+  }
+
+  long lanes[2], ov[2], tg[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  _mm_storeu_si128((__m128i*)ov, ovf);
+  _mm_storeu_si128((__m128i*)tg, tags);
+  return lsum_finish(lanes, 2, ov[0] | ov[1], (uintptr_t)(tg[0] & tg[1]), args + i, n - i, out);
+}
+
+// Two accumulators keep both vector adders busy
+__attribute__((target("avx2")))
+static int lsum_avx2(lval_t** args, int n, long* out) {
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  __m256i ovf = _mm256_setzero_si256();
+  __m256i tags = _mm256_set1_epi64x(-1), strip = _mm256_set1_epi64x(~1LL);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i w0 = _mm256_loadu_si256((const __m256i*)(args + i));
+    __m256i w1 = _mm256_loadu_si256((const __m256i*)(args + i + 4));
+    __m256i x0 = _mm256_and_si256(w0, strip);
+    __m256i x1 = _mm256_and_si256(w1, strip);
+    __m256i s0 = _mm256_add_epi64(acc0, x0);
+    __m256i s1 = _mm256_add_epi64(acc1, x1);
+    tags = _mm256_and_si256(tags, _mm256_and_si256(w0, w1));
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(acc0, s0), _mm256_xor_si256(x0, s0)));
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(acc1, s1), _mm256_xor_si256(x1, s1)));
+    acc0 = s0;
+    acc1 = s1;
+  }
+
+  long lanes[8], ov[4], tg[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc0);
+  _mm256_storeu_si256((__m256i*)(lanes + 4), acc1);
+  _mm256_storeu_si256((__m256i*)ov, ovf);
+  _mm256_storeu_si256((__m256i*)tg, tags);
+  return lsum_finish(lanes, 8, ov[0] | ov[1] | ov[2] | ov[3],
+      (uintptr_t)(tg[0] & tg[1] & tg[2] & tg[3]), args + i, n - i, out);
+}
+#endif
+
+// Picked once at startup by larith_init
+static int (*lsum)(lval_t** args, int n, long* out) = lsum_scalar;
+
+void larith_init(void) {
+#ifdef LARITH_X86
+  __builtin_cpu_init();
+  lsum = __builtin_cpu_supports("avx2") ? lsum_avx2 : lsum_sse2;
+#endif
+}
+
+// Products overflow after a handful of large factors, so there is nothing
+// to gain from lanes, only from a loop with no type checks in it
+static int lprod(lval_t** args, int n, long* out) {
+  uintptr_t tags = 1;
+  long acc = 1;
+  int ovf = 0;
+  for (int i = 0; i < n; i++) {
+    tags &= (uintptr_t)args[i];
+    ovf |= larith_mul(acc, LVAL_FIX_VAL(args[i]), &acc);
+  }
+  if (!(tags & 1) || ovf) { return 0; }
+  *out = acc;
+  return 1;
+}
+
+// Run the kernel for op if there is one, returning 1 with the result in out
+static int lval_arith_kernel(lval_t** args, int argc, int op, long* out) {
+  long a, b;
+  switch (op) {
+    case LBUILTIN_ADD:
+      return lsum(args, argc, out);
+    case LBUILTIN_SUB:
+      return lsum(args, 1, &a) && lsum(args + 1, argc - 1, &b) && !larith_sub(a, b, out);
+    case LBUILTIN_MUL:
+      return lprod(args, argc, out);
+  }
+  return 0;
+}
+
+// Vectors
+//
+// Arithmetic and ordering on vectors works element by element, with plain
+// numbers standing in for a vector of themselves. Elements are longs unless
+// either side has doubles. Longs that overflow are an error rather than
+// bignums, since a vector has no room for one.
+static int lvec_dbl(lval_t* v) {
+  if (lval_type(v) == LVAL_VEC) { return (v->flags & LVAL_DOUBLES) != 0; }
+  return lval_type(v) == LVAL_DBL;
+}
+
+// The elements of v as doubles or longs, converting or repeating a number
+// n times in tmp when it doesn't already have them. NULL if v can't be one.
+static void* lvec_data(lval_t* v, int n, int dbl, void** tmp) {
+  if (lval_type(v) == LVAL_VEC && lvec_dbl(v) == dbl) { return v->ivec; }
+
+  if (lval_type(v) == LVAL_VEC) {
+    double* d = *tmp = malloc(sizeof(double) * n + 1);
+    for (int i = 0; i < n; i++) { d[i] = (double)v->ivec[i]; }
+    return d;
+  }
+
+  if (!lval_is_num(v) || (!dbl && lval_is_big(v))) { return NULL; }
+  if (dbl) {
+    double* d = *tmp = malloc(sizeof(double) * n + 1);
+    double x = lval_double(v);
+    for (int i = 0; i < n; i++) { d[i] = x; }
+    return d;
+  }
+  long* l = *tmp = malloc(sizeof(long) * n + 1);
+  long x = lval_long(v);
+  for (int i = 0; i < n; i++) { l[i] = x; }
+  return l;
+}
+
+// Whether two vectors are both plain or both matrices of one shape
+static int lmat_same_shape(lval_t* a, lval_t* b) {
+  if ((a->flags & LVAL_MATRIX) != (b->flags & LVAL_MATRIX)) { return 0; }
+  if (!(a->flags & LVAL_MATRIX)) { return 1; }
+  return LMAT_ROWS(a) == LMAT_ROWS(b) && LMAT_COLS(a) == LMAT_COLS(b);
+}
+
+// a op b where at least one is a vector, for arithmetic and ordering ops.
+// The result has the shape of the vector, or of both if they match.
+static lval_t* lvec_binop(lval_t* a, lval_t* b, int op) {
+  int na = lval_type(a) == LVAL_VEC ? a->count : -1;
+  int nb = lval_type(b) == LVAL_VEC ? b->count : -1;
+  int n = na >= 0 ? na : nb;
+  lval_t* shape = na >= 0 ? a : b;
+  int dbl = lvec_dbl(a) || lvec_dbl(b);
+  void* ta = NULL;
+  void* tb = NULL;
+  lval_t* r = NULL;
+  int rc = VEC_OK;
+
+  if (na >= 0 && nb >= 0 && ((a->flags | b->flags) & LVAL_MATRIX) && !lmat_same_shape(a, b)) {
+    r = lval_err("Matrix shapes differ!");
+    goto done;
+  }
+  if (na >= 0 && nb >= 0 && na != nb) {
+    r = lval_err("Vectors differ in length!");
+    goto done;
+  }
+  if (op == LBUILTIN_POW) {
+    r = lval_err("Cannot raise a vector to a power");
+    goto done;
+  }
+
+  void* da = lvec_data(a, n, dbl, &ta);
+  void* db = lvec_data(b, n, dbl, &tb);
+  if (!da || !db) {
+    r = lval_err(lval_is_num(a) && lval_is_num(b) ? "Number too big for a vector"
+                                                  : "Cannot operate on a non-number");
+    goto done;
+  }
+
+  int kop = 0;
+  int cmp = 0;
+  switch (op) {
+    case LBUILTIN_ADD: kop = VEC_ADD; break;
+    case LBUILTIN_SUB: kop = VEC_SUB; break;
+    case LBUILTIN_MUL: kop = VEC_MUL; break;
+    case LBUILTIN_DIV: kop = VEC_DIV; break;
+    case LBUILTIN_MOD: kop = VEC_MOD; break;
+    case LBUILTIN_LT: kop = VEC_LT; cmp = 1; break;
+    case LBUILTIN_GT: kop = VEC_GT; cmp = 1; break;
+    case LBUILTIN_LE: kop = VEC_LE; cmp = 1; break;
+    case LBUILTIN_GE: kop = VEC_GE; cmp = 1; break;
+  }
+
+  r = lval_vec_like(shape, dbl && !cmp);
+  if (cmp && dbl) {
+    vec_cmp_d(kop, r->ivec, da, db, n);
+  } else if (cmp) {
+    vec_cmp_l(kop, r->ivec, da, db, n);
+  } else if (dbl) {
+    rc = vec_arith_d(kop, r->dvec, da, db, n);
+  } else {
+    rc = vec_arith_l(kop, r->ivec, da, db, n);
+  }
+
+  if (rc != VEC_OK) {
+    lval_del(r);
+    r = lval_err(rc == VEC_DIV_ZERO ? "Division by Zero!" : "Integer overflow in vector");
+  }
+
+done:
+  free(ta);
+  free(tb);
+  lval_del(a);
+  lval_del(b);
+  return r;
+}
+
+// Fold the arguments pairwise, left to right, once any is a vector
+static lval_t* lval_arith_vec(lval_t** args, int argc, int op) {
+  if (argc == 1 && op == LBUILTIN_SUB) { return lvec_binop(lval_num(0), args[0], op); }
+
+  lval_t* acc = args[0];
+  int i = 1;
+  while (i < argc) {
+    lval_t* y = args[i++];
+    if (lval_type(acc) == LVAL_VEC || lval_type(y) == LVAL_VEC) {
+      acc = lvec_binop(acc, y, op);
+    } else {
+      lval_t* pair[2] = { acc, y };
+      acc = lval_arith(pair, 2, op);
+    }
+    if (lval_type(acc) == LVAL_ERR) { break; }
+  }
+
+  while (i < argc) { lval_del(args[i++]); }
+  return acc;
+}
+
+lval_t* lval_arith(lval_t** args, int argc, int op) {
+  lval_t* err = NULL;
+  int dbl = 0;
+  int vec = 0;
+
+  // Only fixnums got this far, so there is nothing to delete
+  long k;
+  if (argc >= LARITH_KERNEL_MIN && lval_arith_kernel(args, argc, op, &k)) {
+    return lval_num(k);
+  }
+
+  // Ensure all args are numbers or vectors
+  for (int i = 0; i < argc; i++) {
+    if (!lval_is_num(args[i]) && lval_type(args[i]) != LVAL_VEC) {
+      err = lval_err("Cannot operate on a non-number");
+      break;
+    }
+    dbl |= lval_type(args[i]) == LVAL_DBL;
+    vec |= lval_type(args[i]) == LVAL_VEC;
+  }
+
+  if (!err && vec) { return lval_arith_vec(args, argc, op); }
+
+  lval_t* r = err;
+  if (!err && dbl) {
+    r = lval_arith_dbl(args, argc, op);
+  } else if (!err) {
+    long acc;
+    int i = lval_arith_long(args, argc, op, &acc, &err);
+    if (err) {
+      r = err;
+    } else if (i < argc) {
+      r = lval_arith_big(args, argc, op, i, acc);
+    } else {
+      r = lval_num(acc);
+    }
+  }
+
+  for (int i = 0; i < argc; i++) {
+    lval_del(args[i]);
+  }
+  return r;
+}
+
+lval_t* builtin_op(lval_t* x, int op) {
+  lval_t* r = lval_arith(x->cell, x->count, op);
+  x->count = 0;
+  lval_del(x);
+  return r;
+}
+
+lval_t* builtin_add(lval_t* x) { return builtin_op(x, LBUILTIN_ADD); }
+lval_t* builtin_sub(lval_t* x) { return builtin_op(x, LBUILTIN_SUB); }
+lval_t* builtin_mul(lval_t* x) { return builtin_op(x, LBUILTIN_MUL); }
+lval_t* builtin_div(lval_t* x) { return builtin_op(x, LBUILTIN_DIV); }
+lval_t* builtin_mod(lval_t* x) { return builtin_op(x, LBUILTIN_MOD); }
+lval_t* builtin_pow(lval_t* x) { return builtin_op(x, LBUILTIN_POW); }
+
+lval_t* builtin_head(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'head' pass too many arguements!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'head' passed incorrect types!");
+  LASSERT(x, lval_count(x->cell[0]) != 0, "Function 'head' passed {}!");
+
+  lval_t* f = lval_take(x, 0);
+
+  // A shared list hands out a view of its first cell instead
+  if (lval_shared(f)) {
+    lval_t* h = lval_view(f, 0, 1);
+    lval_del(f);
+    return h;
+  }
+
+  lval_truncate(f, 1);
+  return f;
+}
+
+lval_t* builtin_tail(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'tail' pass too many arguements!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'tail' passed incorrect types!");
+  LASSERT(x, lval_count(x->cell[0]) != 0, "Function 'tail' passed {}!");
+  
+  lval_t* f = lval_take(x, 0);
+
+  // A shared list hands out a view of everything after the first cell
+  if (lval_shared(f)) {
+    lval_t* t = lval_view(f, 1, f->count - 1);
+    lval_del(f);
+    return t;
+  }
+
+  lval_del(lval_pop(f, 0));
+  return f;
+}
+
+lval_t* builtin_list(lval_t* x) {
+  return lval_retype(x, LVAL_QEXPR);
+}
+
+// Hands back the expression for the VM to evaluate in place of the call
+lval_t* builtin_eval(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'eval' passed too many arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'eval' passed incorrect type!");
+
+  return lval_retype(lval_take(x, 0), LVAL_SEXPR);
+}
+
+// Like eval, hands back the branch to take
+lval_t* builtin_if(lval_t* x) {
+  LASSERT(x, x->count == 3, "Function 'if' passed incorrect number of arguments!");
+  LASSERT(x, lval_is_num(x->cell[0]), "Function 'if' passed incorrect type!");
+  LASSERT(x, lval_type(x->cell[1]) == LVAL_QEXPR && lval_type(x->cell[2]) == LVAL_QEXPR,
+      "Function 'if' passed incorrect type!");
+
+  return lval_retype(lval_take(x, lval_true(x->cell[0]) ? 1 : 2), LVAL_SEXPR);
+}
+
+// Pairs still to compare are kept on a worklist, so nesting depth is
+// limited only by memory
+int lval_eq(lval_t* x, lval_t* y) {
+  lval_t** work = NULL;
+  int n = 0, cap = 0, eq = 1;
+  lval_push(&work, &n, &cap, x);
+  lval_push(&work, &n, &cap, y);
+
+  while (eq && n) {
+    y = work[--n];
+    x = work[--n];
+    // Integers and doubles are equal when their values are
+    if (lval_is_num(x) && lval_is_num(y)) {
+      if (lval_type(x) == LVAL_DBL || lval_type(y) == LVAL_DBL) {
+        eq = lval_double(x) == lval_double(y);
+      } else {
+        eq = lval_num_cmp(x, y) == 0;
+      }
+      continue;
+    }
+    if (lval_type(x) != lval_type(y)) { eq = 0; break; }
+
+    switch (lval_type(x)) {
+      case LVAL_VEC:
+        if (x->count != y->count || !lmat_same_shape(x, y)) { eq = 0; break; }
+        for (int i = 0; eq && i < x->count; i++) {
+          if (lvec_dbl(x) || lvec_dbl(y)) {
+            eq = (lvec_dbl(x) ? x->dvec[i] : x->ivec[i]) == (lvec_dbl(y) ? y->dvec[i] : y->ivec[i]);
+          } else {
+            eq = x->ivec[i] == y->ivec[i];
+          }
+        }
+        break;
+      case LVAL_ERR: eq = strcmp(x->err, y->err) == 0; break;
+      case LVAL_SYM: eq = x->sym == y->sym; break;
+      case LVAL_FUTURE: eq = x->task == y->task; break;
+      case LVAL_FUN:
+        if (!x->proc || !y->proc) {
+          eq = x->proc == y->proc && x->count == y->count;
+        } else {
+          lval_push(&work, &n, &cap, x->proc->src);
+          lval_push(&work, &n, &cap, y->proc->src);
+        }
+        break;
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        if (lval_count(x) != lval_count(y)) { eq = 0; break; }
+        for (int i = 0; i < lval_count(x); i++) {
+          lval_push(&work, &n, &cap, x->cell[i]);
+          lval_push(&work, &n, &cap, y->cell[i]);
+        }
+        break;
+    }
+  }
+
+  free(work);
+  return eq;
+}
+
+lval_t* builtin_cmp(lval_t* x, int op) {
+  LASSERT(x, x->count == 2, "Function passed incorrect number of arguments!");
+
+  int r = lval_eq(x->cell[0], x->cell[1]);
+  lval_del(x);
+  return lval_num(op == LBUILTIN_EQ ? r : !r);
+}
+
+lval_t* builtin_ord(lval_t* x, int op) {
+  LASSERT(x, x->count == 2, "Function passed incorrect number of arguments!");
+
+  if (lval_type(x->cell[0]) == LVAL_VEC || lval_type(x->cell[1]) == LVAL_VEC) {
+    lval_t* a = lval_pop(x, 0);
+    return lvec_binop(a, lval_take(x, 0), op);
+  }
+  LASSERT(x, lval_is_num(x->cell[0]) && lval_is_num(x->cell[1]),
+      "Cannot compare a non-number");
+
+  int r = 0;
+  if (lval_type(x->cell[0]) == LVAL_DBL || lval_type(x->cell[1]) == LVAL_DBL) {
+    double a = lval_double(x->cell[0]);
+    double b = lval_double(x->cell[1]);
+    switch (op) {
+      case LBUILTIN_GT: r = a > b; break;
+      case LBUILTIN_LT: r = a < b; break;
+      case LBUILTIN_GE: r = a >= b; break;
+      case LBUILTIN_LE: r = a <= b; break;
+    }
+  } else {
+    int c = lval_num_cmp(x->cell[0], x->cell[1]);
+    switch (op) {
+      case LBUILTIN_GT: r = c > 0; break;
+      case LBUILTIN_LT: r = c < 0; break;
+      case LBUILTIN_GE: r = c >= 0; break;
+      case LBUILTIN_LE: r = c <= 0; break;
+    }
+  }
+  lval_del(x);
+  return lval_num(r);
+}
+
+// Numbers in a Q-expression into a vector, and back
+lval_t* builtin_vec(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'vec' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'vec' passed incorrect type!");
+
+  lval_t* q = x->cell[0];
+  int n = lval_count(q), dbl = 0;
+  for (int i = 0; i < n; i++) {
+    LASSERT(x, lval_is_num(q->cell[i]), "Function 'vec' passed a non-number!");
+    dbl |= lval_type(q->cell[i]) == LVAL_DBL;
+  }
+
+  lval_t* v = lval_vec(n, dbl);
+  for (int i = 0; i < n; i++) {
+    lval_t* c = q->cell[i];
+    if (dbl) {
+      v->dvec[i] = lval_double(c);
+    } else if (lval_is_big(c)) {
+      lval_del(v);
+      lval_del(x);
+      return lval_err("Number too big for a vector");
+    } else {
+      v->ivec[i] = lval_long(c);
+    }
+  }
+  lval_del(x);
+  return v;
+}
+
+// Elements i to i + n of v in a Q-expression
+static lval_t* lval_unvec(lval_t* v, int i, int n) {
+  if (n == 0) { return lval_qexpr(); }
+  lval_t* q = lval_list(LVAL_QEXPR, n);
+  for (int j = 0; j < n; j++) {
+    q->cell[j] = (v->flags & LVAL_DOUBLES) ? lval_dbl(v->dvec[i + j]) : lval_num(v->ivec[i + j]);
+  }
+  q->count = n;
+  return q;
+}
+
+// A matrix comes back as a Q-expression of its rows
+lval_t* builtin_unvec(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'unvec' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_VEC, "Function 'unvec' passed incorrect type!");
+
+  lval_t* v = x->cell[0];
+  lval_t* q;
+  if (v->flags & LVAL_MATRIX) {
+    int rows = LMAT_ROWS(v), cols = LMAT_COLS(v);
+    q = lval_list(LVAL_QEXPR, rows);
+    for (int i = 0; i < rows; i++) { q->cell[i] = lval_unvec(v, i * cols, cols); }
+    q->count = rows;
+  } else {
+    q = lval_unvec(v, 0, v->count);
+  }
+  lval_del(x);
+  return q;
+}
+
+// Dot products of longs that overflow are worked out again with bignums
+lval_t* builtin_dot(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function 'dot' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_VEC && lval_type(x->cell[1]) == LVAL_VEC,
+      "Function 'dot' passed incorrect type!");
+  LASSERT(x, x->cell[0]->count == x->cell[1]->count, "Vectors differ in length!");
+
+  lval_t* a = x->cell[0];
+  lval_t* b = x->cell[1];
+  int n = a->count;
+  lval_t* r;
+
+  if (!lvec_dbl(a) && !lvec_dbl(b)) {
+    long d;
+    if (vec_dot_l(a->ivec, b->ivec, n, &d) == VEC_OK) {
+      r = lval_num(d);
+    } else {
+      uint32_t ab[2], bb[2];
+      bignum_t acc = { 0, 0, NULL };
+      for (int i = 0; i < n; i++) {
+        bignum_t p = big_mul(big_from_long(a->ivec[i], ab), big_from_long(b->ivec[i], bb));
+        bignum_t s = big_add(acc, p);
+        big_free(&p);
+        big_free(&acc);
+        acc = s;
+      }
+      r = lval_big(acc);
+    }
+  } else {
+    void* ta = NULL;
+    void* tb = NULL;
+    double* da = lvec_data(a, n, 1, &ta);
+    double* db = lvec_data(b, n, 1, &tb);
+    r = lval_dbl(vec_dot_d(da, db, n));
+    free(ta);
+    free(tb);
+  }
+
+  lval_del(x);
+  return r;
+}
+
+// Smallest or largest of any mix of numbers and vectors
+lval_t* builtin_extreme(lval_t* x, int op) {
+  lval_t* best = NULL;
+
+  for (int i = 0; i < x->count; i++) {
+    lval_t* c = x->cell[i];
+    lval_t* cand;
+    if (lval_type(c) == LVAL_VEC) {
+      if (c->count == 0) { continue; }
+      if (c->flags & LVAL_DOUBLES) {
+        cand = lval_dbl(op == LBUILTIN_MIN ? vec_min_d(c->dvec, c->count) : vec_max_d(c->dvec, c->count));
+      } else {
+        cand = lval_num(op == LBUILTIN_MIN ? vec_min_l(c->ivec, c->count) : vec_max_l(c->ivec, c->count));
+      }
+    } else if (lval_is_num(c)) {
+      cand = lval_copy(c);
+    } else {
+      if (best) { lval_del(best); }
+      lval_del(x);
+      return lval_err("Cannot compare a non-number");
+    }
+
+    if (!best) {
+      best = cand;
+      continue;
+    }
+
+    int better;
+    if (lval_type(cand) == LVAL_DBL || lval_type(best) == LVAL_DBL) {
+      double a = lval_double(cand), b = lval_double(best);
+      better = op == LBUILTIN_MIN ? a < b : a > b;
+    } else {
+      int c = lval_num_cmp(cand, best);
+      better = op == LBUILTIN_MIN ? c < 0 : c > 0;
+    }
+    if (better) {
+      lval_del(best);
+      best = cand;
+    } else {
+      lval_del(cand);
+    }
+  }
+
+  LASSERT(x, best, "Function passed no numbers!");
+  lval_del(x);
+  return best;
+}
+
+lval_t* builtin_scan(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'scan' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_VEC, "Function 'scan' passed incorrect type!");
+
+  lval_t* v = x->cell[0];
+  lval_t* r = lval_vec(v->count, v->flags & LVAL_DOUBLES);
+  if (v->flags & LVAL_DOUBLES) {
+    vec_scan_d(r->dvec, v->dvec, v->count);
+  } else if (vec_scan_l(r->ivec, v->ivec, v->count) != VEC_OK) {
+    lval_del(r);
+    r = lval_err("Integer overflow in vector");
+  }
+  lval_del(x);
+  return r;
+}
+
+// Matrices
+
+// The elements of a vector laid out as rows by cols
+lval_t* builtin_matrix(lval_t* x) {
+  LASSERT(x, x->count == 3, "Function 'matrix' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_NUM && lval_type(x->cell[1]) == LVAL_NUM
+      && lval_type(x->cell[2]) == LVAL_VEC, "Function 'matrix' passed incorrect type!");
+
+  lval_t* v = x->cell[2];
+  long rows = lval_is_big(x->cell[0]) ? -1 : lval_long(x->cell[0]);
+  long cols = lval_is_big(x->cell[1]) ? -1 : lval_long(x->cell[1]);
+  LASSERT(x, rows != 0 && cols != 0, "Matrix must have a row and a column!");
+  LASSERT(x, rows > 0 && cols > 0 && rows <= INT_MAX && cols <= INT_MAX
+      && rows * cols == v->count, "Matrix shape doesn't fit the vector!");
+
+  lval_t* m = lval_mat(rows, cols, v->flags & LVAL_DOUBLES);
+  memcpy(m->ivec, v->ivec, sizeof(long) * v->count);
+  lval_del(x);
+  return m;
+}
+
+lval_t* builtin_matmul(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function 'matmul' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_VEC && lval_type(x->cell[1]) == LVAL_VEC
+      && (x->cell[0]->flags & x->cell[1]->flags & LVAL_MATRIX), "Function 'matmul' passed incorrect type!");
+
+  lval_t* a = x->cell[0];
+  lval_t* b = x->cell[1];
+  int n = LMAT_ROWS(a), k = LMAT_COLS(a), m = LMAT_COLS(b);
+  LASSERT(x, k == LMAT_ROWS(b), "Matrix shapes differ!");
+  LASSERT(x, (long)n * m <= INT_MAX, "Matrix too big!");
+
+  int dbl = lvec_dbl(a) || lvec_dbl(b);
+  void* ta = NULL;
+  void* tb = NULL;
+  void* da = lvec_data(a, a->count, dbl, &ta);
+  void* db = lvec_data(b, b->count, dbl, &tb);
+  lval_t* r = lval_mat(n, m, dbl);
+  if (dbl) {
+    mat_mul_d(r->dvec, da, db, n, k, m);
+  } else if (mat_mul_l(r->ivec, da, db, n, k, m) != VEC_OK) {
+    lval_del(r);
+    r = lval_err("Integer overflow in matrix");
+  }
+
+  free(ta);
+  free(tb);
+  lval_del(x);
+  return r;
+}
+
+lval_t* builtin_transpose(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'transpose' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_VEC && (x->cell[0]->flags & LVAL_MATRIX),
+      "Function 'transpose' passed incorrect type!");
+
+  lval_t* v = x->cell[0];
+  lval_t* r = lval_mat(LMAT_COLS(v), LMAT_ROWS(v), v->flags & LVAL_DOUBLES);
+  mat_transpose(r->ivec, v->ivec, LMAT_ROWS(v), LMAT_COLS(v));
+  lval_del(x);
+  return r;
+}
+
+lval_t* builtin_min(lval_t* x) { return builtin_extreme(x, LBUILTIN_MIN); }
+lval_t* builtin_max(lval_t* x) { return builtin_extreme(x, LBUILTIN_MAX); }
+
+lval_t* builtin_eq(lval_t* x) { return builtin_cmp(x, LBUILTIN_EQ); }
+lval_t* builtin_ne(lval_t* x) { return builtin_cmp(x, LBUILTIN_NE); }
+lval_t* builtin_gt(lval_t* x) { return builtin_ord(x, LBUILTIN_GT); }
+lval_t* builtin_lt(lval_t* x) { return builtin_ord(x, LBUILTIN_LT); }
+lval_t* builtin_ge(lval_t* x) { return builtin_ord(x, LBUILTIN_GE); }
+lval_t* builtin_le(lval_t* x) { return builtin_ord(x, LBUILTIN_LE); }
+
+lval_t* lval_join(lval_t* x, lval_t* y) {
+  if (lval_count(y) == 0) { lval_del(y); return x; }
+  if (lval_count(x) == 0) { lval_del(x); return y; }
+
+  x = lval_own(x);
+  lval_reserve(x, x->count + y->count);
+
+  int n = y->count;
+  if (lval_shared(y)) {
+    // Someone else can still see y's cells, so share each of them
+    for (int i = 0; i < y->count; i++) {
+      x->cell[x->count + i] = lval_copy(y->cell[i]);
+    }
+  } else {
+    // Move all of y's cells across in one go
+    memcpy(&x->cell[x->count], y->cell, sizeof(lval_t*) * y->count);
+    y->count = 0;
+  }
+
+  x->count += n;
+  lval_barrier(x);
+  lval_del(y);
+  return x;
+}
+
+lval_t* builtin_join(lval_t* x) {
+  for (int i = 0; i < x->count; i++) {
+    LASSERT(x, lval_type(x->cell[i]) == LVAL_QEXPR, "Function 'join' passed incorrect type!");
+  }
+
+  lval_t* f = lval_own(lval_pop(x, 0));
+
+  // Size the result once for everything being joined
+  if (!LVAL_IS_IMM(f)) {
+    int total = f->count;
+    for (int i = 0; i < x->count; i++) { total += lval_count(x->cell[i]); }
+    lval_reserve(f, total);
+  }
+
+  while(x->count) {
+    f = lval_join(f, lval_pop(x, 0));
+  }
+
+  lval_del(x);
+  return f;
+}
+
+// Global environment
+//
+// Globals live in an open addressing table keyed by the interned symbol
+// itself, so a lookup hashes and compares a pointer. Stored values are always
+// on the heap, since they outlive the line that defined them.
+static size_t lenv_hash(lsym_t* s) {
+  return ((uintptr_t)s >> 4) * 11400714819323198485u;
+}
+
+static void lenv_grow(void) {
+  size_t cap = lctx->env_cap ? lctx->env_cap * 2 : 64;
+  lsym_t** keys = calloc(cap, sizeof(lsym_t*));
+  lval_t** vals = malloc(sizeof(lval_t*) * cap);
+
+  for (size_t i = 0; i < lctx->env_cap; i++) {
+    if (!lctx->env_keys[i]) { continue; }
+    size_t j = lenv_hash(lctx->env_keys[i]) & (cap - 1);
+    while (keys[j]) { j = (j + 1) & (cap - 1); }
+    keys[j] = lctx->env_keys[i];
+    vals[j] = lctx->env_vals[i];
+  }
+
+  free(lctx->env_keys);
+  free(lctx->env_vals);
+  lctx->env_keys = keys;
+  lctx->env_vals = vals;
+  lctx->env_cap = cap;
+}
+
+// Drop every global
+void lenv_free(void) {
+  for (size_t i = 0; i < lctx->env_cap; i++) {
+    if (lctx->env_keys[i]) { lval_del(lctx->env_vals[i]); }
+  }
+  free(lctx->env_keys);
+  free(lctx->env_vals);
+  lctx->env_keys = NULL;
+  lctx->env_vals = NULL;
+  lctx->env_count = lctx->env_cap = 0;
+}
+
+lval_t* lenv_get(lsym_t* s) {
+  if (!lctx->env_cap) { return NULL; }
+
+  size_t i = lenv_hash(s) & (lctx->env_cap - 1);
+  while (lctx->env_keys[i]) {
+    if (lctx->env_keys[i] == s) { return lctx->env_vals[i]; }
+    i = (i + 1) & (lctx->env_cap - 1);
+  }
+  return NULL;
+}
+
+// Bind s to the heap value v, replacing any earlier binding
+void lenv_put(lsym_t* s, lval_t* v) {
+  if ((lctx->env_count + 1) * 4 > lctx->env_cap * 3) { lenv_grow(); }
+
+  s->version++;
+  size_t i = lenv_hash(s) & (lctx->env_cap - 1);
+  while (lctx->env_keys[i]) {
+    if (lctx->env_keys[i] == s) {
+      lval_del(lctx->env_vals[i]);
+      lctx->env_vals[i] = v;
+      return;
+    }
+    i = (i + 1) & (lctx->env_cap - 1);
+  }
+
+  lctx->env_keys[i] = s;
+  lctx->env_vals[i] = v;
+  lctx->env_count++;
+}
+
+lval_t* builtin_def(lval_t* x) {
+  LASSERT(x, x->count > 0 && lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'def' passed incorrect type!");
+
+  lval_t* syms = x->cell[0];
+  for (int i = 0; i < lval_count(syms); i++) {
+    LASSERT(x, lval_type(syms->cell[i]) == LVAL_SYM, "Function 'def' cannot define non-symbol!");
+    LASSERT(x, syms->cell[i]->sym->builtin == LBUILTIN_NONE, "Function 'def' cannot redefine a builtin!");
+  }
+  LASSERT(x, lval_count(syms) == x->count - 1, "Function 'def' passed incorrect number of values to symbols!");
+
+  for (int i = 0; i < lval_count(syms); i++) {
+    lenv_put(syms->cell[i]->sym, lval_promote(lval_copy(x->cell[i + 1])));
+  }
+
+  lval_del(x);
+  return lval_sexpr();
+}
+
+struct lscope;
+lval_t* lproc_new(lval_t* formals, lval_t* body, struct lscope* parent);
+lval_t* lval_lambda(lval_t* proc, lval_t* env);
+
+lval_t* builtin_lambda(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function '\\' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR && lval_type(x->cell[1]) == LVAL_QEXPR,
+      "Function '\\' passed incorrect type!");
+
+  // Built at run time, so only its own formals and globals are in scope
+  lval_t* p = lproc_new(x->cell[0], x->cell[1], NULL);
+  lval_del(x);
+  if (p->type == LVAL_ERR) { return p; }
+
+  lval_t* f = lval_lambda(p, lval_sexpr());
+  lval_del(p);
+  return f;
+}
+
+// let is compiled inline when it is written out, so this only runs when its
+// arguments were computed. It hands back ((\ {names} body) values...).
+lval_t* builtin_let(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function 'let' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR && lval_type(x->cell[1]) == LVAL_QEXPR,
+      "Function 'let' passed incorrect type!");
+
+  lval_t* binds = x->cell[0];
+  LASSERT(x, lval_count(binds) % 2 == 0, "Function 'let' passed an unpaired binding!");
+
+  lval_t* names = lval_qexpr();
+  lval_t* call = lval_sexpr();
+  for (int i = 0; i < lval_count(binds); i += 2) {
+    names = lval_add(names, lval_copy(binds->cell[i]));
+  }
+
+  lval_t* fn = lval_add(lval_sexpr(), lval_sym("\\"));
+  fn = lval_add(fn, names);
+  fn = lval_add(fn, lval_copy(x->cell[1]));
+  call = lval_add(call, fn);
+  for (int i = 1; i < lval_count(binds); i += 2) {
+    call = lval_add(call, lval_copy(binds->cell[i]));
+  }
+
+  lval_del(x);
+  return call;
+}
+
+typedef lval_t* (*lbuiltin_t)(lval_t*);
+
+// Defined with the thread pool code, further down
+lval_t* builtin_pmap(lval_t* x);
+lval_t* builtin_pfilter(lval_t* x);
+lval_t* builtin_preduce(lval_t* x);
+lval_t* builtin_future(lval_t* x);
+lval_t* builtin_promise(lval_t* x);
+lval_t* builtin_await(lval_t* x);
+
+// Builtins indexed by ID. Those that evaluate return an S-expression for the
+// VM to run in their place, so they never call back into it.
+static const struct {
+  char* name;
+  lbuiltin_t fn;
+  int evals;
+} builtins[LBUILTIN_COUNT] = {
+  [LBUILTIN_ADD] = { "+", builtin_add },
+  [LBUILTIN_SUB] = { "-", builtin_sub },
+  [LBUILTIN_MUL] = { "*", builtin_mul },
+  [LBUILTIN_DIV] = { "/", builtin_div },
+  [LBUILTIN_MOD] = { "%", builtin_mod },
+  [LBUILTIN_POW] = { "^", builtin_pow },
+  [LBUILTIN_LIST] = { "list", builtin_list },
+  [LBUILTIN_HEAD] = { "head", builtin_head },
+  [LBUILTIN_TAIL] = { "tail", builtin_tail },
+  [LBUILTIN_JOIN] = { "join", builtin_join },
+  [LBUILTIN_EVAL] = { "eval", builtin_eval, 1 },
+  [LBUILTIN_DEF] = { "def", builtin_def },
+  [LBUILTIN_LAMBDA] = { "\\", builtin_lambda },
+  [LBUILTIN_LET] = { "let", builtin_let, 1 },
+  [LBUILTIN_IF] = { "if", builtin_if, 1 },
+  [LBUILTIN_EQ] = { "==", builtin_eq },
+  [LBUILTIN_NE] = { "!=", builtin_ne },
+  [LBUILTIN_GT] = { ">", builtin_gt },
+  [LBUILTIN_LT] = { "<", builtin_lt },
+  [LBUILTIN_GE] = { ">=", builtin_ge },
+  [LBUILTIN_LE] = { "<=", builtin_le },
+  [LBUILTIN_VEC] = { "vec", builtin_vec },
+  [LBUILTIN_UNVEC] = { "unvec", builtin_unvec },
+  [LBUILTIN_DOT] = { "dot", builtin_dot },
+  [LBUILTIN_MIN] = { "min", builtin_min },
+  [LBUILTIN_MAX] = { "max", builtin_max },
+  [LBUILTIN_SCAN] = { "scan", builtin_scan },
+  [LBUILTIN_MATRIX] = { "matrix", builtin_matrix },
+  [LBUILTIN_MATMUL] = { "matmul", builtin_matmul },
+  [LBUILTIN_TRANSPOSE] = { "transpose", builtin_transpose },
+  [LBUILTIN_PMAP] = { "pmap", builtin_pmap, 1 },
+  [LBUILTIN_PFILTER] = { "pfilter", builtin_pfilter, 1 },
+  [LBUILTIN_PREDUCE] = { "preduce", builtin_preduce, 1 },
+  [LBUILTIN_FUTURE] = { "future", builtin_future, 1 },
+  [LBUILTIN_PROMISE] = { "promise", builtin_promise },
+  [LBUILTIN_AWAIT] = { "await", builtin_await, 1 },
+};
+
+// The value each builtin's name evaluates to. These are never freed or
+// changed, so every context shares them.
+static lval_t lbuiltin_funs[LBUILTIN_COUNT];
+
+void lbuiltins_init(void) {
+  for (int i = 0; i < LBUILTIN_COUNT; i++) {
+    lbuiltin_funs[i].type = LVAL_FUN;
+    lbuiltin_funs[i].refs = LVAL_REFS_MAX;
+    lbuiltin_funs[i].count = i;
+  }
+}
+
+// Mark the builtins' names in the symbol table
+void lbuiltins_intern(void) {
+  for (int i = 0; i < LBUILTIN_COUNT; i++) { lsym_intern(builtins[i].name)->builtin = i; }
+}
+
+// Bytecode
+//
+// An expression is compiled once into a flat array of words and a constant
+// pool, then run on a value stack. Each opcode is followed by its operands.
+enum {
+  OP_CONST,   // k          push a copy of constant k
+  OP_ERR,     // k          stop with a copy of error constant k
+  OP_ARITH,   // op argc    fold argc numbers with arithmetic builtin op
+  OP_BUILTIN, // f argc     call builtin f on argc arguments
+  OP_CALL,    // argc       call the function sitting below argc arguments
+  OP_TAILCALL,// argc       call, replacing the current frame
+  OP_JUMP,    // to         continue at to
+  OP_JUMPF,   // to         pop a number, continuing at to if it is zero
+  OP_LOCAL,   // depth i    push a copy of local i, depth scopes out
+  OP_GLOBAL,  // k ic       push a copy of the global named by symbol k
+  OP_CLOSURE, // k          push a lambda running proc k in the current env
+  OP_FORK,    // n to       run the n calls that follow at once, then continue at to
+  OP_RET,     //            return the top of the stack
+};
+
+// Lexical scope of the lambda being compiled. Locals are found at compile
+// time and addressed by how many scopes out they are and their index there.
+// At run time each scope is an env: a list of the enclosing env followed by
+// one slot per local.
+typedef struct lscope {
+  struct lscope* parent;
+  lsym_t** names;
+  int count;
+} lscope_t;
+
+// Inline cache of one global lookup: the value found there, good for as long
+// as the symbol's version hasn't moved on. The value isn't counted as a
+// reference, since a redefinition that could free it also bumps the version.
+typedef struct {
+  lval_t* value;
+  unsigned version;
+} lcache_t;
+
+typedef struct lcode {
+  int count;
+  int cap;
+  int* code;
+  int kcount;
+  int kcap;
+  lval_t** consts;
+  int depth;
+  int max_depth;
+  int argc;
+  int rest;
+  lscope_t* scope;
+  int ccount;
+  lcache_t* caches;
+  int calls;
+  int jit_failed;
+  int jit_bails;
+  void* jit;
+  size_t jit_size;
+  double jit_cost;
+  lsym_t* jit_self;
+  unsigned jit_version;
+} lcode_t;
+
+void lcode_emit(lcode_t* c, int w) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->code = realloc(c->code, sizeof(int) * c->cap);
+  }
+  c->code[c->count++] = w;
+}
+
+// Add v to the constant pool, which takes over the reference
+int lcode_const_take(lcode_t* c, lval_t* v) {
+  if (c->kcount == c->kcap) {
+    c->kcap = c->kcap ? c->kcap * 2 : 8;
+    c->consts = realloc(c->consts, sizeof(lval_t*) * c->kcap);
+  }
+  c->consts[c->kcount] = v;
+  return c->kcount++;
+}
+
+int lcode_const(lcode_t* c, lval_t* v) {
+  return lcode_const_take(c, lval_copy(v));
+}
+
+// A new, empty inline cache. The array grows at powers of two.
+int lcode_cache(lcode_t* c) {
+  if ((c->ccount & (c->ccount - 1)) == 0) {
+    c->caches = realloc(c->caches, sizeof(lcache_t) * (c->ccount ? c->ccount * 2 : 1));
+  }
+  c->caches[c->ccount] = (lcache_t){ NULL, 0 };
+  return c->ccount++;
+}
+
+// Track how deep the value stack gets so the VM can size it up front
+void lcode_push(lcode_t* c, int n) {
+  c->depth += n;
+  if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
+
+void lcode_del(lcode_t* c) {
+  for (int i = 0; i < c->kcount; i++) {
+    lval_del(c->consts[i]);
+  }
+  jit_release(c->jit, c->jit_size);
+  free(c->caches);
+  free(c->consts);
+  free(c->code);
+  free(c);
+}
+
+void lval_compile_expr(lcode_t* c, lval_t* x, int tail);
+void lval_compile_sexpr(lcode_t* c, lval_t* x, int tail);
+
+// Drop everything compiled since code offset from and constant kfrom, which
+// pushed n values
+static void lcode_rewind(lcode_t* c, int from, int kfrom, int n) {
+  while (c->kcount > kfrom) { lval_del(c->consts[--c->kcount]); }
+  c->count = from;
+  c->depth -= n;
+}
+
+// The constants pushed by code from offset from on, if it is nothing but n
+// OP_CONSTs
+static lval_t** lcode_consts(lcode_t* c, int from, int n, lval_t** out) {
+  if (c->count - from != 2 * n) { return NULL; }
+  for (int i = 0; i < n; i++) {
+    if (c->code[from + 2 * i] != OP_CONST) { return NULL; }
+    out[i] = c->consts[c->code[from + 2 * i + 1]];
+  }
+  return out;
+}
+
+static int lscope_find(lscope_t* s, lsym_t* sym, int* depth, int* index) {
+  for (*depth = 0; s; s = s->parent, (*depth)++) {
+    for (*index = 0; *index < s->count; (*index)++) {
+      if (s->names[*index] == sym) { return 1; }
+    }
+  }
+  return 0;
+}
+
+void lval_compile_sym(lcode_t* c, lval_t* x) {
+  int depth, index;
+  if (lscope_find(c->scope, x->sym, &depth, &index)) {
+    lcode_emit(c, OP_LOCAL);
+    lcode_emit(c, depth);
+    lcode_emit(c, index);
+  } else if (x->sym->builtin != LBUILTIN_NONE) {
+    lcode_emit(c, OP_CONST);
+    lcode_emit(c, lcode_const(c, &lbuiltin_funs[x->sym->builtin]));
+  } else {
+    lcode_emit(c, OP_GLOBAL);
+    lcode_emit(c, lcode_const(c, x));
+    lcode_emit(c, lcode_cache(c));
+  }
+  lcode_push(c, 1);
+}
+
+// Compile the contents of a Q-expression as if it were evaluated
+void lval_compile_body(lcode_t* c, lval_t* body, int tail) {
+  if (lval_count(body) == 0) {
+    lcode_emit(c, OP_CONST);
+    lcode_emit(c, lcode_const(c, lval_sexpr()));
+    lcode_push(c, 1);
+    return;
+  }
+  lval_compile_sexpr(c, body, tail);
+}
+
+// Procs stay counted in the pool even on arena lines, where closures made
+// from them only pin them
+void lval_compile_closure(lcode_t* c, lval_t* p) {
+  lcode_emit(c, OP_CLOSURE);
+  lcode_emit(c, lcode_const_take(c, p));
+  lcode_push(c, 1);
+}
+
+void lval_compile_call(lcode_t* c, int argc, int tail) {
+  lcode_emit(c, tail ? OP_TAILCALL : OP_CALL);
+  lcode_emit(c, argc);
+  lcode_push(c, -argc);
+}
+
+// Partial evaluation
+//
+// Whatever can be worked out once at compile time is, so it costs nothing
+// each time the code runs. A call to a pure builtin whose arguments all
+// compiled to constants is made there and then and replaced by its result,
+// which in turn may make its caller's arguments constant. An if on a
+// constant compiles only the branch it takes, and eval of a constant
+// Q-expression compiles the expression in place. Calls that fail are left
+// to fail when they run, so errors still only happen if they are reached.
+
+// Builtins that only compute from their arguments. Every promise makes a
+// new future.
+static int lbuiltin_pure(int id) {
+  return !builtins[id].evals && id != LBUILTIN_DEF && id != LBUILTIN_LAMBDA && id != LBUILTIN_PROMISE;
+}
+
+// Integer powers are only worked out ahead for small exponents, so a body
+// that is never run can't stall the definition of its lambda
+#define LFOLD_POW_MAX 256
+
+static int lval_fold_cheap(int id, lval_t** args, int argc) {
+  if (id != LBUILTIN_POW) { return 1; }
+  for (int i = 0; i < argc; i++) {
+    if (lval_type(args[i]) == LVAL_DBL) { return 1; }
+  }
+  for (int i = 1; i < argc; i++) {
+    if (lval_type(args[i]) != LVAL_NUM || lval_is_big(args[i])) { return 0; }
+    if (labs(lval_long(args[i])) > LFOLD_POW_MAX) { return 0; }
+  }
+  return 1;
+}
+
+// Run builtin id now if the argc arguments compiled from offset from and
+// constant kfrom on are all constants, compiling its result instead
+static int lval_compile_fold(lcode_t* c, int id, int argc, int from, int kfrom) {
+  lval_t* small[LVAL_INLINE];
+  lval_t** args = argc <= LVAL_INLINE ? small : malloc(sizeof(lval_t*) * argc);
+  int folded = 0;
+
+  if (lbuiltin_pure(id) && lcode_consts(c, from, argc, args) && lval_fold_cheap(id, args, argc)) {
+    lval_t* x = lval_list(LVAL_SEXPR, argc);
+    for (int i = 0; i < argc; i++) { x->cell[x->count++] = lval_copy(args[i]); }
+    lval_t* r = builtins[id].fn(x);
+    if (lval_type(r) == LVAL_ERR) {
+      lval_del(r);
+    } else {
+      lcode_rewind(c, from, kfrom, argc);
+      lcode_emit(c, OP_CONST);
+      lcode_emit(c, lcode_const_take(c, r));
+      lcode_push(c, 1);
+      folded = 1;
+    }
+  }
+
+  if (args != small) { free(args); }
+  return folded;
+}
+
+// Whether anything in v is named like a local in scope s. At run time eval
+// only sees globals, so an expression naming none of them means the same
+// compiled in place.
+static int lval_names_local(lval_t* v, lscope_t* s) {
+  if (!s) { return 0; }
+
+  int n = 0, cap = 0, found = 0, depth, index;
+  lval_t** todo = NULL;
+  lval_push(&todo, &n, &cap, v);
+  while (n && !found) {
+    lval_t* x = todo[--n];
+    if (lval_type(x) == LVAL_SYM) {
+      found = lscope_find(s, x->sym, &depth, &index);
+    } else if (lval_type(x) == LVAL_SEXPR || lval_type(x) == LVAL_QEXPR) {
+      for (int i = 0; i < lval_count(x); i++) { lval_push(&todo, &n, &cap, x->cell[i]); }
+    }
+  }
+  free(todo);
+  return found;
+}
+
+// eval, compiled from offset from and constant kfrom along with its one
+// argument, of a constant Q-expression
+static int lval_compile_eval(lcode_t* c, int from, int kfrom, int tail) {
+  lval_t* k[2];
+  if (!lcode_consts(c, from, 2, k) || lval_type(k[1]) != LVAL_QEXPR || lval_names_local(k[1], c->scope)) {
+    return 0;
+  }
+
+  lval_t* q = lval_copy(k[1]);
+  lcode_rewind(c, from, kfrom, 2);
+  lval_compile_body(c, q, tail);
+  lval_del(q);
+  return 1;
+}
+
+// Sibling calls
+//
+// A run of arguments that are each a call of a name on names and numbers,
+// like the two in (+ (fib n) (fib m)), is compiled as usual behind an
+// OP_FORK. When it runs, the fork looks the calls up without running any of
+// them. If each is to a lambda the JIT has compiled, on fixnums, it runs
+// them natively, spread over the thread pool once they have been seen to
+// take long enough, and skips the code after it. Otherwise that code runs.
+#define LFORK_CALLS 16
+#define LFORK_ARGS 8
+
+static int lval_forkable(lcode_t* c, lval_t* x) {
+  int depth, index;
+  if (lval_type(x) != LVAL_SEXPR || lval_count(x) < 2 || lval_count(x) > LFORK_ARGS + 1) { return 0; }
+  lval_t* f = x->cell[0];
+  if (lval_type(f) != LVAL_SYM) { return 0; }
+  if (f->sym->builtin != LBUILTIN_NONE && !lscope_find(c->scope, f->sym, &depth, &index)) { return 0; }
+  for (int i = 1; i < x->count; i++) {
+    if (lval_type(x->cell[i]) != LVAL_SYM && !lval_is_num(x->cell[i])) { return 0; }
+  }
+  return 1;
+}
+
+static void lval_compile_siblings(lcode_t* c, lval_t** xs, int n) {
+  for (int i = 0; i < n;) {
+    int run = 0;
+    while (i + run < n && run < LFORK_CALLS && lval_forkable(c, xs[i + run])) { run++; }
+    if (run < 2) {
+      lval_compile_expr(c, xs[i++], 0);
+      continue;
+    }
+
+    lcode_emit(c, OP_FORK);
+    lcode_emit(c, run);
+    int to = c->count;
+    lcode_emit(c, 0);
+    for (int j = 0; j < run; j++) { lval_compile_expr(c, xs[i++], 0); }
+    c->code[to] = c->count;
+  }
+}
+
+// Compile the arguments of x to builtin id, returning how many there were.
+// The arguments of a call to the same operator written first are spliced
+// in, so (+ (+ a b) c) runs as (+ a b c): operators fold from the left, so
+// the answer is the same. (+ a (+ b c)) is left alone, since doubles would
+// round differently if regrouped.
+static int lval_compile_args(lcode_t* c, lval_t* x, int id) {
+  int argc = 0, i = 1, depth, index;
+  lval_t* first = x->cell[1];
+  if ((id == LBUILTIN_ADD || id == LBUILTIN_SUB || id == LBUILTIN_MUL) &&
+      lval_type(first) == LVAL_SEXPR && first->count >= 3 &&
+      lval_type(first->cell[0]) == LVAL_SYM && first->cell[0]->sym->builtin == id &&
+      !lscope_find(c->scope, first->cell[0]->sym, &depth, &index)) {
+    argc = lval_compile_args(c, first, id);
+    i = 2;
+  }
+  lval_compile_siblings(c, x->cell + i, x->count - i);
+  return argc + x->count - i;
+}
+
+// Lambdas, lets and ifs written out in full are compiled in the enclosing
+// scope, returning 0 to leave anything else to the builtin at run time
+int lval_compile_special(lcode_t* c, lval_t* x, int tail) {
+  switch (x->cell[0]->sym->builtin) {
+    case LBUILTIN_LAMBDA: {
+      if (x->count != 3 || lval_type(x->cell[1]) != LVAL_QEXPR || lval_type(x->cell[2]) != LVAL_QEXPR) {
+        return 0;
+      }
+      lval_t* p = lproc_new(x->cell[1], x->cell[2], c->scope);
+      if (p->type == LVAL_ERR) { lval_del(p); return 0; }
+      lval_compile_closure(c, p);
+      return 1;
+    }
+
+    case LBUILTIN_LET: {
+      if (x->count != 3 || lval_type(x->cell[1]) != LVAL_QEXPR || lval_type(x->cell[2]) != LVAL_QEXPR) {
+        return 0;
+      }
+
+      // Call a lambda of the names on the values
+      lval_t* binds = x->cell[1];
+      int n = lval_count(binds) / 2;
+      if (lval_count(binds) % 2) { return 0; }
+
+      lval_t* names = lval_list(LVAL_QEXPR, n);
+      for (int i = 0; i < n; i++) { names->cell[names->count++] = lval_copy(binds->cell[i * 2]); }
+      lval_t* p = lproc_new(names, x->cell[2], c->scope);
+      lval_del(names);
+      if (p->type == LVAL_ERR) { lval_del(p); return 0; }
+
+      lval_compile_closure(c, p);
+      for (int i = 0; i < n; i++) { lval_compile_expr(c, binds->cell[i * 2 + 1], 0); }
+      lval_compile_call(c, n, tail);
+      return 1;
+    }
+
+    case LBUILTIN_IF: {
+      if (x->count != 4 || lval_type(x->cell[2]) != LVAL_QEXPR || lval_type(x->cell[3]) != LVAL_QEXPR) {
+        return 0;
+      }
+
+      // Only the branch taken runs, in the tail position of the if
+      int from = c->count, kfrom = c->kcount;
+      lval_t* cond;
+      lval_compile_expr(c, x->cell[1], 0);
+      if (lcode_consts(c, from, 1, &cond) && lval_is_num(cond)) {
+        int yes = lval_true(cond);
+        lcode_rewind(c, from, kfrom, 1);
+        lval_compile_body(c, x->cell[yes ? 2 : 3], tail);
+        return 1;
+      }
+
+      lcode_emit(c, OP_JUMPF);
+      int to_else = c->count;
+      lcode_emit(c, 0);
+      lcode_push(c, -1);
+
+      int depth = c->depth;
+      lval_compile_body(c, x->cell[2], tail);
+      lcode_emit(c, OP_JUMP);
+      int to_end = c->count;
+      lcode_emit(c, 0);
+
+      c->code[to_else] = c->count;
+      c->depth = depth;
+      lval_compile_body(c, x->cell[3], tail);
+      c->code[to_end] = c->count;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void lval_compile_sexpr(lcode_t* c, lval_t* x, int tail) {
+  // Empty expression
+  if (lval_count(x) == 0) {
+    lcode_emit(c, OP_CONST);
+    lcode_emit(c, lcode_const(c, x));
+    lcode_push(c, 1);
+    return;
+  }
+
+  // Single expression
+  if (x->count == 1) {
+    lval_compile_expr(c, x->cell[0], tail);
+    return;
+  }
+
+  int argc = x->count - 1;
+  lval_t* f = x->cell[0];
+
+  // Operators and builtins named directly are dispatched at compile time,
+  // unless a local of the same name hides them. Builtins that hand back
+  // code to run go through a call, so that code can take over the frame.
+  int depth, index;
+  if (lval_type(f) == LVAL_SYM && f->sym->builtin != LBUILTIN_NONE &&
+      !lscope_find(c->scope, f->sym, &depth, &index)) {
+    if (lval_compile_special(c, x, tail)) { return; }
+    int id = f->sym->builtin;
+    if (!builtins[id].evals) {
+      int from = c->count, kfrom = c->kcount;
+      argc = lval_compile_args(c, x, id);
+      if (lval_compile_fold(c, id, argc, from, kfrom)) { return; }
+      lcode_emit(c, id <= LBUILTIN_POW ? OP_ARITH : OP_BUILTIN);
+      lcode_emit(c, id);
+      lcode_emit(c, argc);
+      lcode_push(c, 1 - argc);
+      return;
+    }
+  }
+
+  // Anything else is resolved when it runs
+  int from = c->count, kfrom = c->kcount;
+  lval_compile_expr(c, f, 0);
+  lval_compile_siblings(c, x->cell + 1, argc);
+  if (argc == 1 && lval_type(f) == LVAL_SYM && f->sym->builtin == LBUILTIN_EVAL &&
+      !lscope_find(c->scope, f->sym, &depth, &index) && lval_compile_eval(c, from, kfrom, tail)) {
+    return;
+  }
+  lval_compile_call(c, argc, tail);
+}
+
+void lval_compile_expr(lcode_t* c, lval_t* x, int tail) {
+  switch (lval_type(x)) {
+    case LVAL_SEXPR:
+      lval_compile_sexpr(c, x, tail);
+      break;
+    case LVAL_SYM:
+      lval_compile_sym(c, x);
+      break;
+    case LVAL_ERR:
+      lcode_emit(c, OP_ERR);
+      lcode_emit(c, lcode_const(c, x));
+      lcode_push(c, 1);
+      break;
+    default:
+      lcode_emit(c, OP_CONST);
+      lcode_emit(c, lcode_const(c, x));
+      lcode_push(c, 1);
+      break;
+  }
+}
+
+// Whatever an expression evaluates to last is in tail position
+lcode_t* lval_compile(lval_t* x) {
+  lcode_t* c = calloc(1, sizeof(lcode_t));
+  lval_compile_expr(c, x, 1);
+  lcode_emit(c, OP_RET);
+  return c;
+}
+
+// Compile a lambda body once, in a new scope holding its formals. A formal
+// after '&' collects any remaining arguments as a Q-expression. Procs are
+// always made on the heap, since closures over them can be defined globally.
+lval_t* lproc_new(lval_t* formals, lval_t* body, lscope_t* parent) {
+  int n = lval_count(formals);
+  lsym_t** names = malloc(sizeof(lsym_t*) * (n + 1));
+  int count = 0, rest = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (lval_type(formals->cell[i]) != LVAL_SYM) {
+      free(names);
+      return lval_err("Cannot define non-symbol!");
+    }
+    if (strcmp(formals->cell[i]->sym->name, "&") == 0) {
+      if (rest || i != n - 2) {
+        free(names);
+        return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
+      }
+      rest = 1;
+      continue;
+    }
+    names[count++] = formals->cell[i]->sym;
+  }
+
+  larena_t* a = lctx->alloc;
+  lctx->alloc = NULL;
+
+  lval_t* src = lval_add(lval_add(lval_qexpr(), lval_clone(formals)), lval_clone(body));
+  lscope_t scope = { parent, names, count };
+  lcode_t* c = calloc(1, sizeof(lcode_t));
+  c->argc = count - rest;
+  c->rest = rest;
+  c->scope = &scope;
+  lval_compile_body(c, src->cell[1], 1);
+  lcode_emit(c, OP_RET);
+  c->scope = NULL;
+
+  lval_t* p = lval_new(LVAL_PROC, sizeof(lval_t));
+  p->code = c;
+  p->src = src;
+  lctx->alloc = a;
+
+  free(names);
+  return p;
+}
+
+lval_t* lval_lambda(lval_t* proc, lval_t* env) {
+  lval_t* f = lval_new(LVAL_FUN, sizeof(lval_t));
+  f->count = LBUILTIN_NONE;
+  f->proc = lval_copy(proc);
+  f->env = env;
+  return f;
+}
+
+// Gather the top argc stack values into a fresh S-expression
+lval_t* lval_args(lval_t** args, int argc) {
+  if (argc == 0) { return lval_sexpr(); }
+
+  lval_t* x = lval_list(LVAL_SEXPR, argc);
+  memcpy(x->cell, args, sizeof(lval_t*) * argc);
+  x->count = argc;
+  return x;
+}
+
+// Collection
+//
+// Every running lval_run links its VM here. Between them the VMs hold every
+// arena value still in use: what is on their value stacks, and the env and
+// code constants of each of their frames.
+//
+// Calls never recurse in C. Each call gets a frame on a stack that grows on
+// the heap, holding where it is in its code, its env, and where its values
+// start on the shared value stack. A call in tail position replaces the
+// caller's frame, so loops written as tail recursion run in constant space.
+#define LVAL_STACK 64
+#define LVAL_FRAMES 16
+
+typedef struct lframe {
+  lcode_t* code;
+  int* ip;
+  lval_t* env;
+  lval_t* proc;
+  int base;
+} lframe_t;
+
+typedef struct lvm {
+  struct lvm* prev;
+  lframe_t* frames;
+  int nframes;
+  int framecap;
+  lval_t** stack;
+  lval_t** sp;
+  int stackcap;
+  lval_t* small[LVAL_STACK];
+  lframe_t small_frames[LVAL_FRAMES];
+} lvm_t;
+
+
+// Where a moved value left the address of its copy. Lists and vectors keep
+// their elements readable, since views of them still find their offset.
+static lval_t** lgc_forward(lval_t* v) {
+  if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR || v->type == LVAL_VEC) { return &v->owner; }
+  return (lval_t**)&v->num;
+}
+
+// Return the copy of v in dst, making it on first visit
+static lval_t* lgc_move(lval_t* v, larena_t* dst, int major) {
+  if (LVAL_IS_IMM(v) || !(v->flags & LVAL_ARENA)) { return v; }
+  if ((v->flags & LVAL_OLD) && !major) { return v; }
+  if (v->flags & LVAL_FORWARD) {
+    lval_t* n = *lgc_forward(v);
+    lval_retain(n);
+    return n;
+  }
+
+  lval_t* n;
+  if (v->flags & LVAL_VIEW) {
+    ptrdiff_t off = v->cell - v->owner->cell;
+    n = larena_alloc(dst, sizeof(lval_t));
+    *n = *v;
+    n->owner = lgc_move(v->owner, dst, major);
+    n->cell = n->owner->cell + off;
+  } else if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+    // Copies are packed to exactly their count and scanned later
+    if (v->count <= LVAL_INLINE) {
+      n = larena_alloc(dst, sizeof(lval_t) + sizeof(lval_t*) * v->count);
+      *n = *v;
+      n->cell = n->buf;
+    } else {
+      n = larena_alloc(dst, sizeof(lval_t));
+      *n = *v;
+      n->cell = larena_alloc(dst, sizeof(lval_t*) * v->count);
+    }
+    memcpy(n->cell, v->cell, sizeof(lval_t*) * v->count);
+    n->cap = v->count;
+    n->start = 0;
+    lval_push(&lctx->gc.scan, &lctx->gc.nscan, &lctx->gc.scancap, n);
+  } else if (v->type == LVAL_VEC) {
+    int shape = (v->flags & LVAL_MATRIX) ? 2 : 0;
+    n = larena_alloc(dst, sizeof(lval_t) + sizeof(long) * (shape + v->count));
+    *n = *v;
+    n->ivec = (long*)n->buf + shape;
+    memcpy(n->ivec - shape, v->ivec - shape, sizeof(long) * (shape + v->count));
+  } else {
+    n = larena_alloc(dst, sizeof(lval_t));
+    *n = *v;
+    if (v->type == LVAL_ERR) {
+      n->err = larena_alloc(dst, strlen(v->err) + 1);
+      strcpy(n->err, v->err);
+    }
+    if (v->type == LVAL_NUM && v->count > 0) {
+      n->big = larena_alloc(dst, sizeof(uint32_t) * v->count);
+      memcpy(n->big, v->big, sizeof(uint32_t) * v->count);
+    }
+    if (v->type == LVAL_FUN) { n->env = lgc_move(v->env, dst, major); }
+  }
+
+  n->flags = (v->flags & (LVAL_VIEW | LVAL_DOUBLES | LVAL_MATRIX)) | LVAL_ARENA | LVAL_OLD;
+  n->refs = 1;
+  v->flags |= LVAL_FORWARD;
+  *lgc_forward(v) = n;
+  return n;
+}
+
+static double lgc_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void lgc_collect(void) {
+  double start = lgc_now();
+
+  // A full collection copies the tenured space as well into a fresh one
+  int major = lctx->gc.old.allocated > lctx->gc.old_limit;
+  larena_t fresh = { 0 };
+  larena_t* dst = major ? &fresh : &lctx->gc.old;
+
+  for (lvm_t* vm = lctx->vms; vm; vm = vm->prev) {
+    for (lval_t** p = vm->stack; p < vm->sp; p++) {
+      *p = lgc_move(*p, dst, major);
+    }
+
+    // Procs keep their constants on the heap, so only code a frame owns
+    // can hold arena values, and no other frame shares it
+    for (int i = 0; i < vm->nframes; i++) {
+      lframe_t* fr = &vm->frames[i];
+      fr->env = lgc_move(fr->env, dst, major);
+      if (fr->proc) { continue; }
+      for (int k = 0; k < fr->code->kcount; k++) {
+        fr->code->consts[k] = lgc_move(fr->code->consts[k], dst, major);
+      }
+    }
+  }
+
+  // Tenured lists that were written to may hold the only nursery references
+  for (int i = 0; i < lctx->gc.nremembered; i++) {
+    lval_t* v = lctx->gc.remembered[i];
+    v->flags &= ~LVAL_REMEMBERED;
+    if (!major) { lval_push(&lctx->gc.scan, &lctx->gc.nscan, &lctx->gc.scancap, v); }
+  }
+  lctx->gc.nremembered = 0;
+
+  while (lctx->gc.nscan) {
+    lval_t* v = lctx->gc.scan[--lctx->gc.nscan];
+    for (int i = 0; i < v->count; i++) {
+      v->cell[i] = lgc_move(v->cell[i], dst, major);
+    }
+  }
+
+  larena_rewind(lctx->alloc);
+  if (major) {
+    larena_free(&lctx->gc.old);
+    lctx->gc.old = fresh;
+    size_t limit = lctx->gc.old.allocated / 100 * lctx->gc.growth;
+    lctx->gc.old_limit = limit > LGC_OLD_MIN ? limit : LGC_OLD_MIN;
+    lctx->gc.major++;
+  } else {
+    lctx->gc.minor++;
+  }
+
+  double pause = lgc_now() - start;
+  int bucket = 0;
+  for (double us = pause * 1e6; us >= 1 && bucket < 31; us /= 2) { bucket++; }
+  lctx->gc.pauses[bucket]++;
+  lctx->gc.pause_total += pause;
+  if (pause > lctx->gc.pause_max) { lctx->gc.pause_max = pause; }
+}
+
+// Free queued heap lists, letting go of at most budget cells
+void lgc_sweep(int budget) {
+  while (lctx->gc.ndead > 0 && budget > 0) {
+    lval_t* v = lctx->gc.dead[--lctx->gc.ndead];
+    while (v->count > 0 && budget > 0) {
+      lval_del(v->cell[--v->count]);
+      budget--;
+    }
+
+    // Come back to whatever is left next time
+    if (v->count > 0) {
+      lval_push(&lctx->gc.dead, &lctx->gc.ndead, &lctx->gc.deadcap, v);
+      return;
+    }
+    if (v->cell - v->start != v->buf) { free(v->cell - v->start); }
+    free(v);
+  }
+}
+
+// Drop the tenured space along with the rest of the line
+void lgc_reset(void) {
+  larena_free(&lctx->gc.old);
+  lctx->gc.old_limit = LGC_OLD_MIN;
+  lctx->gc.nremembered = 0;
+  lgc_sweep(INT_MAX);
+
+  unsigned long total = lctx->gc.minor + lctx->gc.major;
+  if (lctx->gc.stats && total) {
+    // Pauses are bucketed by powers of two microseconds
+    unsigned long seen = 0;
+    int p99 = 0;
+    while (p99 < 31 && (seen += lctx->gc.pauses[p99]) * 100 < total * 99) { p99++; }
+    fprintf(stderr, "gc: %lu minor, %lu major, pause max %.0fus p99 <%luus total %.3fms\n",
+        lctx->gc.minor, lctx->gc.major, lctx->gc.pause_max * 1e6, 1ul << p99, lctx->gc.pause_total * 1e3);
+  }
+  lctx->gc.minor = lctx->gc.major = 0;
+  lctx->gc.pause_total = lctx->gc.pause_max = 0;
+  memset(lctx->gc.pauses, 0, sizeof(lctx->gc.pauses));
+}
+
+static size_t lgc_env(const char* name, size_t fallback) {
+  char* s = getenv(name);
+  if (!s) { return fallback; }
+  char* end;
+  unsigned long n = strtoul(s, &end, 10);
+  return (end != s && n > 0) ? n : fallback;
+}
+
+void lgc_init(void) {
+  lctx->gc = (lgc_t){
+    .nursery_limit = lgc_env("FLISPY_GC_NURSERY", 4 << 20),
+    .old_limit = LGC_OLD_MIN,
+    .growth = lgc_env("FLISPY_GC_GROWTH", 200),
+    .sweep_budget = lgc_env("FLISPY_GC_SWEEP", 4096),
+    .stats = getenv("FLISPY_GC_STATS") != NULL,
+  };
+}
+
+// Free everything the collector holds, once the heap has let go of its
+// values
+void lgc_free(void) {
+  lgc_sweep(INT_MAX);
+  larena_free(&lctx->gc.old);
+  free(lctx->gc.remembered);
+  free(lctx->gc.dead);
+  free(lctx->gc.scan);
+  lctx->gc = (lgc_t){ 0 };
+}
+
+// Called before each call, when everything live is on a stack
+#define LGC_SAFEPOINT() \
+  if (lctx->alloc && lctx->alloc->allocated > lctx->gc.nursery_limit) { lgc_collect(); } \
+  if (lctx->gc.ndead) { lgc_sweep(lctx->gc.sweep_budget); }
+
+lval_t* lval_unbound(lsym_t* s) {
+  char* m = malloc(strlen(s->name) + 32);
+  sprintf(m, "Unbound Symbol '%s'", s->name);
+  lval_t* err = lval_err(m);
+  free(m);
+  return err;
+}
+
+// Make the env for a call to lambda f: the env it closed over, then one slot
+// per formal. Consumes f and the argc values at args.
+static lval_t* lval_bind(lval_t* f, lval_t** args, int argc) {
+  lcode_t* c = f->proc->code;
+  if (argc < c->argc || (argc > c->argc && !c->rest)) {
+    for (int i = 0; i < argc; i++) { lval_del(args[i]); }
+    lval_del(f);
+    return lval_err("Function passed incorrect number of arguments!");
+  }
+
+  lval_t* env = lval_list(LVAL_SEXPR, c->argc + c->rest + 1);
+  env->cell[0] = lval_copy(f->env);
+  memcpy(env->cell + 1, args, sizeof(lval_t*) * c->argc);
+  if (c->rest) {
+    env->cell[c->argc + 1] = lval_retype(lval_args(args + c->argc, argc - c->argc), LVAL_QEXPR);
+  }
+  env->count = c->argc + c->rest + 1;
+  lval_del(f);
+  return env;
+}
+
+// Start a frame running c with its values from sp on, growing the frame and
+// value stacks as needed. Returns sp, which moves if the value stack does.
+static lval_t** lvm_push(lvm_t* vm, lval_t** sp, lcode_t* c, lval_t* env, lval_t* proc) {
+  if (vm->nframes == vm->framecap) {
+    vm->framecap *= 2;
+    if (vm->frames == vm->small_frames) {
+      vm->frames = malloc(sizeof(lframe_t) * vm->framecap);
+      memcpy(vm->frames, vm->small_frames, sizeof(vm->small_frames));
+    } else {
+      vm->frames = realloc(vm->frames, sizeof(lframe_t) * vm->framecap);
+    }
+  }
+
+  int base = sp - vm->stack;
+  if (base + c->max_depth > vm->stackcap) {
+    int cap = vm->stackcap * 2;
+    if (cap < base + c->max_depth) { cap = base + c->max_depth; }
+    if (vm->stack == vm->small) {
+      vm->stack = malloc(sizeof(lval_t*) * cap);
+      memcpy(vm->stack, vm->small, sizeof(lval_t*) * base);
+    } else {
+      vm->stack = realloc(vm->stack, sizeof(lval_t*) * cap);
+    }
+    vm->stackcap = cap;
+  }
+
+  vm->frames[vm->nframes++] = (lframe_t){ c, c->code, env, proc, base };
+  return vm->stack + base;
+}
+
+// Drop the top frame's env, and its code if nothing else owns it
+static void lvm_pop(lvm_t* vm) {
+  lframe_t* fr = &vm->frames[--vm->nframes];
+  lval_del(fr->env);
+  if (fr->proc) {
+    lval_del(fr->proc);
+  } else {
+    lcode_del(fr->code);
+  }
+}
+
+// Inline cache counters
+//
+// Every OP_GLOBAL counts whether its cache answered or it had to look the
+// name up. With FLISPY_IC_STATS set, the counts for each line are printed
+// after it.
+void lic_init(void) {
+  lctx->ic.hits = lctx->ic.misses = 0;
+  lctx->ic.stats = getenv("FLISPY_IC_STATS") != NULL;
+}
+
+void lic_reset(void) {
+  if (lctx->ic.stats && (lctx->ic.hits || lctx->ic.misses)) {
+    fprintf(stderr, "ic: %lu hits, %lu misses\n", lctx->ic.hits, lctx->ic.misses);
+  }
+  lctx->ic.hits = lctx->ic.misses = 0;
+}
+
+// The global an OP_GLOBAL with operands w names, or NULL if it is unbound
+static lval_t* lcode_global(lcode_t* c, int* w) {
+  lsym_t* s = c->consts[w[0]]->sym;
+  lcache_t* ic = &c->caches[w[1]];
+  if (ic->value && ic->version == s->version) {
+    lctx->ic.hits++;
+    return ic->value;
+  }
+
+  lctx->ic.misses++;
+  lval_t* v = lenv_get(s);
+  if (v) {
+    ic->value = v;
+    ic->version = s->version;
+  }
+  return v;
+}
+
+// JIT
+//
+// Lambdas that get called often are translated to x86-64 if all they do is
+// fixnum arithmetic and comparisons on their own arguments, branch with if,
+// and call themselves. Each slot of the bytecode's value stack gets a fixed
+// place in the native frame, so every opcode has one template. Once the
+// arguments are checked to be fixnums on entry every value is one, so the
+// code never allocates or touches a reference count. Anything it can't
+// finish, an overflow, a division by zero, or recursion too deep for the C
+// stack, makes it give up and the call is run by the VM instead. The code
+// has no side effects, so nothing is lost but time. Tail calls to itself
+// store their arguments back over the caller's before looping, so a loop
+// that gives up carries on in the VM from where it was.
+//
+// FLISPY_JIT=0 turns it off.
+typedef long (*ljit_fn_t)(lval_t** args, long depth);
+
+// Calls before a lambda is compiled, native calls deep it can go, and
+// times it can give up before it is left to the VM for good. Without that
+// last limit, a recursion deeper than LJIT_DEPTH would go that deep again
+// natively from each of its levels.
+#define LJIT_HOT 64
+#define LJIT_DEPTH 10000
+#define LJIT_BAILS 8
+
+static int ljit_on = 1;
+
+// Words in each instruction, with its operands
+static const int lop_size[] = {
+  [OP_CONST] = 2, [OP_ERR] = 2, [OP_ARITH] = 3, [OP_BUILTIN] = 3,
+  [OP_CALL] = 2, [OP_TAILCALL] = 2, [OP_JUMP] = 2, [OP_JUMPF] = 2,
+  [OP_LOCAL] = 3, [OP_GLOBAL] = 3, [OP_CLOSURE] = 2, [OP_FORK] = 3,
+  [OP_RET] = 1,
+};
+
+void ljit_init(void) {
+  char* s = getenv("FLISPY_JIT");
+  ljit_on = jit_supported() && !(s && strcmp(s, "0") == 0);
+}
+
+// Where stack slot i lives, below the saved rbp, r12 and r13
+static int ljit_slot(int nslots, int i) {
+  return -16 - 8 * nslots + 8 * i;
+}
+
+// Fold the n slots from base into the first with arithmetic builtin op
+static void ljit_arith(jit_t* j, int* bail, int* nbail, int nslots, int base, int n, int op) {
+  if (n == 1) {
+    // (- x) is 2 - x on tagged words; + and * of one number are that number
+    if (op != LBUILTIN_SUB) { return; }
+    jit_imm(j, JIT_RAX, 2);
+    jit_load(j, JIT_RCX, JIT_RBP, ljit_slot(nslots, base));
+    jit_alu(j, JIT_SUB, JIT_RAX, JIT_RCX);
+    bail[(*nbail)++] = jit_jump(j, JIT_O);
+    jit_store(j, JIT_RBP, ljit_slot(nslots, base), JIT_RAX);
+    return;
+  }
+
+  // A fixnum word is twice its value plus one
+  jit_load(j, JIT_RAX, JIT_RBP, ljit_slot(nslots, base));
+  for (int i = 1; i < n; i++) {
+    jit_load(j, JIT_RCX, JIT_RBP, ljit_slot(nslots, base + i));
+    switch (op) {
+      case LBUILTIN_ADD:
+        jit_alu_imm(j, JIT_SUB, JIT_RAX, 1);
+        jit_alu(j, JIT_ADD, JIT_RAX, JIT_RCX);
+        bail[(*nbail)++] = jit_jump(j, JIT_O);
+        break;
+      case LBUILTIN_SUB:
+        jit_alu(j, JIT_SUB, JIT_RAX, JIT_RCX);
+        bail[(*nbail)++] = jit_jump(j, JIT_O);
+        jit_alu_imm(j, JIT_ADD, JIT_RAX, 1);
+        break;
+      case LBUILTIN_MUL:
+        jit_sar1(j, JIT_RAX);
+        jit_alu_imm(j, JIT_SUB, JIT_RCX, 1);
+        jit_imul(j, JIT_RAX, JIT_RCX);
+        bail[(*nbail)++] = jit_jump(j, JIT_O);
+        jit_alu_imm(j, JIT_ADD, JIT_RAX, 1);
+        break;
+      case LBUILTIN_DIV:
+      case LBUILTIN_MOD:
+        jit_sar1(j, JIT_RAX);
+        jit_sar1(j, JIT_RCX);
+        jit_alu_imm(j, JIT_CMP, JIT_RCX, 0);
+        bail[(*nbail)++] = jit_jump(j, JIT_E);
+        jit_idiv(j, JIT_RCX);
+        if (op == LBUILTIN_MOD) { jit_mov(j, JIT_RAX, JIT_RDX); }
+        jit_alu(j, JIT_ADD, JIT_RAX, JIT_RAX);
+        bail[(*nbail)++] = jit_jump(j, JIT_O);
+        jit_alu_imm(j, JIT_ADD, JIT_RAX, 1);
+        break;
+    }
+  }
+  jit_store(j, JIT_RBP, ljit_slot(nslots, base), JIT_RAX);
+}
+
+// Native code for proc, or NULL if its code does anything the templates
+// don't cover
+static void* ljit_compile(lval_t* proc, size_t* size) {
+  lcode_t* c = proc->code;
+  if (c->rest) { return NULL; }
+
+  int n = c->count;
+  int nslots = (c->max_depth + 1) & ~1;
+  int* depth = malloc(sizeof(int) * (n + 1));
+  int* at = malloc(sizeof(int) * (n + 1));
+  char* self = calloc(c->max_depth + 1, 1);
+  int* bail = malloc(sizeof(int) * (2 * n + c->argc + 1));
+  int* exits = malloc(sizeof(int) * (n + 1));
+  int* jumps = malloc(sizeof(int) * 2 * (n + 1));
+  int nbail = 0, nexit = 0, njump = 0, ok = 1;
+  for (int i = 0; i <= n; i++) { depth[i] = -1; }
+  depth[0] = 0;
+
+  jit_t j = { 0 };
+  jit_push(&j, JIT_RBP);
+  jit_mov(&j, JIT_RBP, JIT_RSP);
+  jit_push(&j, JIT_R12);
+  jit_push(&j, JIT_R13);
+  jit_alu_imm(&j, JIT_SUB, JIT_RSP, 8 * nslots);
+  jit_mov(&j, JIT_R12, JIT_RDI);
+  jit_mov(&j, JIT_R13, JIT_RSI);
+  jit_alu_imm(&j, JIT_CMP, JIT_R13, 0);
+  bail[nbail++] = jit_jump(&j, JIT_LE);
+  for (int i = 0; i < c->argc; i++) {
+    jit_load(&j, JIT_RAX, JIT_R12, 8 * i);
+    jit_test_imm(&j, JIT_RAX, 1);
+    bail[nbail++] = jit_jump(&j, JIT_E);
+  }
+  int body = j.count;
+
+  for (int ip = 0; ip < n && ok; ip += lop_size[c->code[ip]]) {
+    int* w = c->code + ip + 1;
+    int op = c->code[ip];
+    int d = depth[ip];
+    int next = ip + lop_size[op];
+    at[ip] = j.count;
+    if (d < 0) { continue; }
+
+    switch (op) {
+      case OP_CONST: {
+        lval_t* k = c->consts[w[0]];
+        if (!LVAL_IS_FIX(k)) { ok = 0; break; }
+        jit_imm(&j, JIT_RAX, (long)(uintptr_t)k);
+        jit_store(&j, JIT_RBP, ljit_slot(nslots, d), JIT_RAX);
+        self[d] = 0;
+        depth[next] = d + 1;
+        break;
+      }
+
+      case OP_LOCAL:
+        if (w[0] != 0 || w[1] >= c->argc) { ok = 0; break; }
+        jit_load(&j, JIT_RAX, JIT_R12, 8 * w[1]);
+        jit_store(&j, JIT_RBP, ljit_slot(nslots, d), JIT_RAX);
+        self[d] = 0;
+        depth[next] = d + 1;
+        break;
+
+      // Only the lambda's own name, which is checked again before each run.
+      // Its slot is never written, so it can only be called: anything else
+      // reading it gives up.
+      case OP_GLOBAL: {
+        lval_t* g = lenv_get(c->consts[w[0]]->sym);
+        if (!g || lval_type(g) != LVAL_FUN || g->proc != proc) { ok = 0; break; }
+        c->jit_self = c->consts[w[0]]->sym;
+        c->jit_version = c->jit_self->version;
+        self[d] = 1;
+        depth[next] = d + 1;
+        break;
+      }
+
+      case OP_ARITH: {
+        int base = d - w[1];
+        if (w[0] == LBUILTIN_POW || w[1] < 1) { ok = 0; break; }
+        for (int i = base; i < d; i++) { ok &= !self[i]; }
+        if (!ok) { break; }
+        ljit_arith(&j, bail, &nbail, nslots, base, w[1], w[0]);
+        depth[next] = base + 1;
+        break;
+      }
+
+      // Comparisons of two fixnums compare their words
+      case OP_BUILTIN: {
+        static const int cond[] = {
+          [LBUILTIN_EQ] = JIT_E, [LBUILTIN_NE] = JIT_NE, [LBUILTIN_GT] = JIT_G,
+          [LBUILTIN_LT] = JIT_L, [LBUILTIN_GE] = JIT_GE, [LBUILTIN_LE] = JIT_LE,
+        };
+        int base = d - 2;
+        if (w[0] < LBUILTIN_EQ || w[0] > LBUILTIN_LE || w[1] != 2 || self[base] || self[base + 1]) {
+          ok = 0;
+          break;
+        }
+        jit_load(&j, JIT_RAX, JIT_RBP, ljit_slot(nslots, base));
+        jit_load(&j, JIT_RCX, JIT_RBP, ljit_slot(nslots, base + 1));
+        jit_alu(&j, JIT_CMP, JIT_RAX, JIT_RCX);
+        jit_setcc(&j, cond[w[0]], JIT_RAX);
+        jit_alu(&j, JIT_ADD, JIT_RAX, JIT_RAX);
+        jit_alu_imm(&j, JIT_ADD, JIT_RAX, 1);
+        jit_store(&j, JIT_RBP, ljit_slot(nslots, base), JIT_RAX);
+        depth[next] = base + 1;
+        break;
+      }
+
+      // The word for 0 is 1
+      case OP_JUMPF:
+        if (self[d - 1]) { ok = 0; break; }
+        jit_load(&j, JIT_RAX, JIT_RBP, ljit_slot(nslots, d - 1));
+        jit_alu_imm(&j, JIT_CMP, JIT_RAX, 1);
+        jumps[njump++] = jit_jump(&j, JIT_E);
+        jumps[njump++] = w[0];
+        depth[w[0]] = d - 1;
+        depth[next] = d - 1;
+        break;
+
+      // The branch jumped over doesn't see what this one leaves, so that
+      // must not be the lambda itself
+      case OP_JUMP:
+        if (d > 0 && self[d - 1]) { ok = 0; break; }
+        jumps[njump++] = jit_jump(&j, JIT_ALWAYS);
+        jumps[njump++] = w[0];
+        depth[w[0]] = d;
+        break;
+
+      // Native code runs the calls after a fork one by one anyway
+      case OP_FORK:
+        depth[next] = d;
+        break;
+
+      case OP_RET:
+        if (self[d - 1]) { ok = 0; break; }
+        jit_load(&j, JIT_RAX, JIT_RBP, ljit_slot(nslots, d - 1));
+        exits[nexit++] = jit_jump(&j, JIT_ALWAYS);
+        break;
+
+      case OP_CALL:
+      case OP_TAILCALL: {
+        int base = d - w[0] - 1;
+        if (!self[base] || w[0] != c->argc) { ok = 0; break; }
+        for (int i = base + 1; i < d; i++) { ok &= !self[i]; }
+        if (!ok) { break; }
+        if (op == OP_TAILCALL) {
+          for (int i = 0; i < w[0]; i++) {
+            jit_load(&j, JIT_RAX, JIT_RBP, ljit_slot(nslots, base + 1 + i));
+            jit_store(&j, JIT_R12, 8 * i, JIT_RAX);
+          }
+          jit_patch(&j, jit_jump(&j, JIT_ALWAYS), body);
+          break;
+        }
+        jit_lea(&j, JIT_RDI, JIT_RBP, ljit_slot(nslots, base + 1));
+        jit_lea(&j, JIT_RSI, JIT_R13, -1);
+        jit_patch(&j, jit_call(&j), 0);
+        jit_alu_imm(&j, JIT_CMP, JIT_RAX, 0);
+        bail[nbail++] = jit_jump(&j, JIT_E);
+        jit_store(&j, JIT_RBP, ljit_slot(nslots, base), JIT_RAX);
+        self[base] = 0;
+        depth[next] = base + 1;
+        break;
+      }
+
+      default:
+        ok = 0;
+        break;
+    }
+  }
+
+  void* fn = NULL;
+  if (ok) {
+    for (int i = 0; i < njump; i += 2) { jit_patch(&j, jumps[i], at[jumps[i + 1]]); }
+
+    // Giving up returns 0, which is never a fixnum
+    int fail = j.count;
+    jit_imm(&j, JIT_RAX, 0);
+    int exit = j.count;
+    jit_lea(&j, JIT_RSP, JIT_RBP, -16);
+    jit_pop(&j, JIT_R13);
+    jit_pop(&j, JIT_R12);
+    jit_pop(&j, JIT_RBP);
+    jit_ret(&j);
+    for (int i = 0; i < nbail; i++) { jit_patch(&j, bail[i], fail); }
+    for (int i = 0; i < nexit; i++) { jit_patch(&j, exits[i], exit); }
+    fn = jit_finish(&j, size);
+  } else {
+    free(j.code);
+  }
+
+  free(depth);
+  free(at);
+  free(self);
+  free(bail);
+  free(exits);
+  free(jumps);
+  return fn;
+}
+
+// Native code for a call of proc on argc arguments, if it has been
+// compiled and still calls what it did then
+static ljit_fn_t ljit_ready(lval_t* proc, int argc) {
+  lcode_t* c = proc->code;
+  if (!c->jit || c->jit_failed || argc != c->argc) { return NULL; }
+
+  if (c->jit_self && c->jit_version != c->jit_self->version) {
+    lval_t* g = lenv_get(c->jit_self);
+    if (!g || lval_type(g) != LVAL_FUN || g->proc != proc) { return NULL; }
+    c->jit_version = c->jit_self->version;
+  }
+  return (ljit_fn_t)c->jit;
+}
+
+// As ljit_ready, compiling proc first if it hasn't been yet
+static ljit_fn_t ljit_now(lval_t* proc, int argc) {
+  lcode_t* c = proc->code;
+  if (!c->jit && !c->jit_failed && ljit_on) {
+    c->jit = ljit_compile(proc, &c->jit_size);
+    c->jit_cost = -1;
+    c->jit_failed = !c->jit;
+  }
+  return ljit_ready(proc, argc);
+}
+
+// Run proc natively on its args if it has been compiled, or has just got
+// hot enough to be. NULL means the VM has to run it.
+static lval_t* ljit_enter(lval_t* proc, lval_t** args, int argc) {
+  lcode_t* c = proc->code;
+  if (c->jit_failed) { return NULL; }
+  if (!c->jit && (!ljit_on || ++c->calls < LJIT_HOT)) { return NULL; }
+
+  ljit_fn_t fn = ljit_now(proc, argc);
+  if (!fn) { return NULL; }
+  long r = fn(args, LJIT_DEPTH);
+  if (r) { return (lval_t*)r; }
+  if (++c->jit_bails >= LJIT_BAILS) { c->jit_failed = 1; }
+  return NULL;
+}
+
+// Forks
+//
+// Calls are only spread over the pool when they should take LFORK_MIN
+// seconds all told, since handing them out costs more than that saves for
+// less. What a call should take is what a native call of its lambda took
+// when last timed, which is every run while it is costly and one run in
+// LFORK_SAMPLE while it is cheap. Lambdas never timed count as costly.
+#define LFORK_MIN 1e-4
+#define LFORK_SAMPLE 16
+
+typedef struct {
+  lcode_t* code;
+  ljit_fn_t fn;
+  lval_t* args[LFORK_ARGS];
+  long result;
+  double time;
+} lfork_t;
+
+static void lfork_call(void* arg) {
+  lfork_t* call = arg;
+  double start = lgc_now();
+  call->result = call->fn(call->args, LJIT_DEPTH);
+  call->time = lgc_now() - start;
+}
+
+// Look up the n calls after the fork at ip, each some loads then an
+// OP_CALL, returning 0 if any of them can't be run natively
+static int lfork_find(lcode_t* c, lval_t* env, int* ip, int n, lfork_t* calls) {
+  for (int i = 0; i < n; i++) {
+    lval_t* w[LFORK_ARGS + 1];
+    int k = 0;
+    for (; *ip != OP_CALL; ip += lop_size[*ip]) {
+      lval_t* v = env;
+      switch (*ip) {
+        case OP_CONST:
+          v = c->consts[ip[1]];
+          break;
+        case OP_LOCAL:
+          for (int d = ip[1]; d > 0; d--) { v = v->cell[0]; }
+          v = v->cell[ip[2] + 1];
+          break;
+        default:
+          v = lcode_global(c, ip + 1);
+          if (!v) { return 0; }
+          break;
+      }
+      w[k++] = v;
+    }
+    ip += lop_size[OP_CALL];
+
+    if (lval_type(w[0]) != LVAL_FUN || !w[0]->proc) { return 0; }
+    calls[i].code = w[0]->proc->code;
+    calls[i].fn = ljit_ready(w[0]->proc, k - 1);
+    if (!calls[i].fn) { return 0; }
+    for (int a = 1; a < k; a++) {
+      if (!LVAL_IS_FIX(w[a])) { return 0; }
+      calls[i].args[a - 1] = w[a];
+    }
+  }
+  return 1;
+}
+
+// Run the calls after the fork at ip natively, leaving their answers at
+// sp. 0 means the VM has to run them.
+static int lfork_run(lcode_t* c, lval_t* env, int* ip, lval_t** sp) {
+  lfork_t calls[LFORK_CALLS];
+  int n = ip[0];
+  if (!lfork_find(c, env, ip + 2, n, calls)) { return 0; }
+
+  double cost = 0;
+  for (int i = 0; i < n; i++) {
+    cost += calls[i].code->jit_cost < 0 ? LFORK_MIN : calls[i].code->jit_cost;
+  }
+  int costly = cost >= LFORK_MIN;
+  int timed = costly || lctx->fork_runs++ % LFORK_SAMPLE == 0;
+  if (costly && pool_threads() > 1) {
+    pool_group_t g = { 0 };
+    for (int i = 1; i < n; i++) { pool_spawn(&g, lfork_call, &calls[i]); }
+    lfork_call(&calls[0]);
+    pool_wait(&g);
+  } else if (timed) {
+    for (int i = 0; i < n; i++) { lfork_call(&calls[i]); }
+  } else {
+    for (int i = 0; i < n; i++) { calls[i].result = calls[i].fn(calls[i].args, LJIT_DEPTH); }
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (!calls[i].result) { return 0; }
+    if (timed) { calls[i].code->jit_cost = calls[i].time; }
+  }
+
+  for (int i = 0; i < n; i++) { sp[i] = (lval_t*)calls[i].result; }
+  return 1;
+}
+
+// Parallel builtins
+//
+// pmap, pfilter and preduce mean what map, filter and a left fold written
+// in the language would: each element of the list is evaluated as an
+// argument, so (pmap f {1 x}) is (list (f 1) (f x)). Each works out what
+// it can on the thread pool, a chunk of the list per task, then hands back
+// an S-expression for the VM with those answers filled in and the rest of
+// the calls left in place. Only what touches no values runs off the main
+// thread: native code from the JIT on fixnum elements, and the reduction
+// kernels on runs of fixnums. Chunks are at most LPAR_CHUNK cells, which is
+// what fits in L1, and for calls there are enough of them for every thread
+// to have four.
+#define LPAR_CHUNK 4096
+
+// Calls of a lambda folded per round by preduce, which bounds how deeply
+// nested the expression it hands back is
+#define LPAR_FOLD 256
+
+static int lpar_chunk(int n) {
+  int per = (n + 4 * pool_threads() - 1) / (4 * pool_threads());
+  return per < 1 ? 1 : per > LPAR_CHUNK ? LPAR_CHUNK : per;
+}
+
+typedef struct {
+  ljit_fn_t fn;
+  lval_t** cells;
+  long* out;
+  int n;
+} lpar_map_t;
+
+// Native calls on the fixnums of a chunk, leaving 0 for the VM to do where
+// an element isn't one or the code gives up. The argument is copied out
+// first, since a tail call writes over it.
+static void lpar_map_chunk(void* arg) {
+  lpar_map_t* m = arg;
+  for (int i = 0; i < m->n; i++) {
+    lval_t* a = m->cells[i];
+    m->out[i] = LVAL_IS_FIX(a) ? m->fn(&a, LJIT_DEPTH) : 0;
+  }
+}
+
+// Answers for f on each element of l, or NULL if f has no native code
+static long* lpar_map(lval_t* f, lval_t* l) {
+  int n = lval_count(l);
+  ljit_fn_t fn = n && f->proc ? ljit_now(f->proc, 1) : NULL;
+  if (!fn) { return NULL; }
+
+  int per = lpar_chunk(n);
+  int nchunks = (n + per - 1) / per;
+  long* out = malloc(sizeof(long) * n);
+  lpar_map_t* chunks = malloc(sizeof(lpar_map_t) * nchunks);
+  for (int i = 0; i < nchunks; i++) {
+    int start = i * per;
+    chunks[i] = (lpar_map_t){ fn, l->cell + start, out + start, start + per < n ? per : n - start };
+  }
+
+  pool_group_t g = { 0 };
+  for (int i = 1; i < nchunks; i++) { pool_spawn(&g, lpar_map_chunk, &chunks[i]); }
+  lpar_map_chunk(&chunks[0]);
+  pool_wait(&g);
+  free(chunks);
+  return out;
+}
+
+// (f e) as an expression
+static lval_t* lpar_call(lval_t* f, lval_t* e) {
+  return lval_add(lval_add(lval_sexpr(), lval_copy(f)), lval_copy(e));
+}
+
+lval_t* builtin_pmap(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function 'pmap' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_FUN && lval_type(x->cell[1]) == LVAL_QEXPR,
+      "Function 'pmap' passed incorrect types!");
+
+  lval_t* f = x->cell[0];
+  lval_t* l = x->cell[1];
+  int n = lval_count(l);
+  long* out = lpar_map(f, l);
+
+  int done = 1;
+  for (int i = 0; i < n; i++) { done &= out && out[i] != 0; }
+
+  lval_t* r;
+  if (done) {
+    lval_t* q = n ? lval_list(LVAL_QEXPR, n) : lval_qexpr();
+    for (int i = 0; i < n; i++) { q->cell[q->count++] = (lval_t*)out[i]; }
+    r = lval_add(lval_sexpr(), q);
+  } else {
+    r = lval_list(LVAL_SEXPR, n + 1);
+    r->cell[r->count++] = lval_sym("list");
+    for (int i = 0; i < n; i++) {
+      r->cell[r->count++] = out && out[i] ? (lval_t*)out[i] : lpar_call(f, l->cell[i]);
+    }
+  }
+
+  free(out);
+  lval_del(x);
+  return r;
+}
+
+// (if (p e) {{e}} {{}}), which is e, unevaluated, in a list if p holds
+static lval_t* lpar_keep(lval_t* p, lval_t* e) {
+  lval_t* r = lval_add(lval_sexpr(), lval_sym("if"));
+  r = lval_add(r, lpar_call(p, e));
+  r = lval_add(r, lval_add(lval_qexpr(), lval_add(lval_qexpr(), lval_copy(e))));
+  return lval_add(r, lval_add(lval_qexpr(), lval_qexpr()));
+}
+
+lval_t* builtin_pfilter(lval_t* x) {
+  LASSERT(x, x->count == 2, "Function 'pfilter' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_FUN && lval_type(x->cell[1]) == LVAL_QEXPR,
+      "Function 'pfilter' passed incorrect types!");
+
+  lval_t* p = x->cell[0];
+  lval_t* l = x->cell[1];
+  int n = lval_count(l);
+  long* out = lpar_map(p, l);
+
+  // Elements kept in a row are joined as one list
+  lval_t* r = lval_add(lval_sexpr(), lval_sym("join"));
+  lval_t* run = NULL;
+  for (int i = 0; i < n; i++) {
+    if (out && out[i]) {
+      if (LVAL_FIX_VAL(out[i]) == 0) { continue; }
+      run = lval_add(run ? run : lval_qexpr(), lval_copy(l->cell[i]));
+      continue;
+    }
+    if (run) { r = lval_add(r, run); }
+    run = NULL;
+    r = lval_add(r, lpar_keep(p, l->cell[i]));
+  }
+  if (run) { r = lval_add(r, run); }
+  if (r->count == 1) {
+    lval_del(r);
+    r = lval_add(lval_sexpr(), lval_qexpr());
+  }
+
+  free(out);
+  lval_del(x);
+  return r;
+}
+
+typedef struct {
+  lval_t** cells;
+  int n;
+  int op;
+  long out;
+  int ok;
+} lpar_reduce_t;
+
+static int lpar_extreme(lval_t** args, int n, int op, long* out) {
+  uintptr_t tags = 1;
+  long best = LVAL_FIX_VAL(args[0]);
+  for (int i = 0; i < n; i++) {
+    long x = LVAL_FIX_VAL(args[i]);
+    tags &= (uintptr_t)args[i];
+    best = (op == LBUILTIN_MIN ? x < best : x > best) ? x : best;
+  }
+  if (!(tags & 1)) { return 0; }
+  *out = best;
+  return 1;
+}
+
+// The chunks of a difference are summed, to be taken from its first operand
+static void lpar_reduce_chunk(void* arg) {
+  lpar_reduce_t* r = arg;
+  switch (r->op) {
+    case LBUILTIN_ADD:
+    case LBUILTIN_SUB:
+      r->ok = lsum(r->cells, r->n, &r->out);
+      break;
+    case LBUILTIN_MUL:
+      r->ok = lprod(r->cells, r->n, &r->out);
+      break;
+    default:
+      r->ok = lpar_extreme(r->cells, r->n, r->op, &r->out);
+      break;
+  }
+}
+
+// A kernel's answer for each chunk of the n cells, or NULL if any chunk
+// held something other than fixnums or overflowed
+static lpar_reduce_t* lpar_reduce(int op, lval_t** cells, int n, int* nchunks) {
+  *nchunks = (n + LPAR_CHUNK - 1) / LPAR_CHUNK;
+  lpar_reduce_t* chunks = malloc(sizeof(lpar_reduce_t) * *nchunks);
+  for (int i = 0; i < *nchunks; i++) {
+    int start = i * LPAR_CHUNK;
+    chunks[i] = (lpar_reduce_t){ cells + start, start + LPAR_CHUNK < n ? LPAR_CHUNK : n - start, op, 0, 0 };
+  }
+
+  pool_group_t g = { 0 };
+  for (int i = 1; i < *nchunks; i++) { pool_spawn(&g, lpar_reduce_chunk, &chunks[i]); }
+  lpar_reduce_chunk(&chunks[0]);
+  pool_wait(&g);
+
+  for (int i = 0; i < *nchunks; i++) {
+    if (!chunks[i].ok) {
+      free(chunks);
+      return NULL;
+    }
+  }
+  return chunks;
+}
+
+// Arithmetic builtins and min and max already fold all their arguments from
+// the left, so reducing by one is a single call of it on the whole list.
+// Integers are exact, so for sums, differences, products and extremes of
+// fixnums the list can be cut anywhere and the chunks' answers combined in
+// that call instead. A lone operand is the answer as it is, since - would
+// negate it.
+static lval_t* lpar_reduce_op(int op, lval_t* l, lval_t* init) {
+  int n = lval_count(l);
+  if (n + (init != NULL) == 1) { return lval_add(lval_sexpr(), lval_copy(init ? init : l->cell[0])); }
+
+  int skip = op == LBUILTIN_SUB && !init;
+  int nchunks = 0;
+  lpar_reduce_t* chunks = NULL;
+  if ((op == LBUILTIN_ADD || op == LBUILTIN_SUB || op == LBUILTIN_MUL ||
+       op == LBUILTIN_MIN || op == LBUILTIN_MAX) && n - skip >= 2 * LPAR_CHUNK) {
+    chunks = lpar_reduce(op, l->cell + skip, n - skip, &nchunks);
+  }
+
+  lval_t* r = lval_list(LVAL_SEXPR, (chunks ? nchunks + skip : n) + 2);
+  r->cell[r->count++] = lval_sym(builtins[op].name);
+  if (init) { r->cell[r->count++] = lval_copy(init); }
+  if (chunks) {
+    if (skip) { r->cell[r->count++] = lval_copy(l->cell[0]); }
+    for (int i = 0; i < nchunks; i++) { r->cell[r->count++] = lval_num(chunks[i].out); }
+  } else {
+    for (int i = 0; i < n; i++) { r->cell[r->count++] = lval_copy(l->cell[i]); }
+  }
+  lval_barrier(r);
+  free(chunks);
+  return r;
+}
+
+// Any other function is folded a round of LPAR_FOLD calls at a time, each
+// round handing the rest of the list on to the next as a view, with the
+// expression folded so far as its starting value
+lval_t* builtin_preduce(lval_t* x) {
+  LASSERT(x, x->count == 2 || x->count == 3, "Function 'preduce' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_FUN && lval_type(x->cell[1]) == LVAL_QEXPR,
+      "Function 'preduce' passed incorrect types!");
+
+  lval_t* f = x->cell[0];
+  lval_t* l = x->cell[1];
+  lval_t* init = x->count == 3 ? x->cell[2] : NULL;
+  int n = lval_count(l);
+  LASSERT(x, n > 0 || init, "Function 'preduce' passed {}!");
+
+  lval_t* r;
+  if (!f->proc && (f->count <= LBUILTIN_POW || f->count == LBUILTIN_MIN || f->count == LBUILTIN_MAX)) {
+    r = lpar_reduce_op(f->count, l, init);
+  } else {
+    int i = init ? 0 : 1;
+    int end = n - i > LPAR_FOLD ? i + LPAR_FOLD : n;
+    lval_t* acc = lval_copy(init ? init : l->cell[0]);
+    for (; i < end; i++) {
+      acc = lval_add(lval_add(lval_add(lval_sexpr(), lval_copy(f)), acc), lval_copy(l->cell[i]));
+    }
+
+    if (end < n) {
+      r = lval_add(lval_sexpr(), lval_sym("preduce"));
+      r = lval_add(r, lval_copy(f));
+      r = lval_add(r, lval_view(l, end, n - end));
+      r = lval_add(r, acc);
+    } else {
+      r = lval_add(lval_sexpr(), acc);
+    }
+  }
+
+  lval_del(x);
+  return r;
+}
+
+// Futures
+//
+// (future {expr}) starts expr on a worker and hands back a future at once,
+// and (await f) hands back its value, sleeping until the worker is done.
+// As with the parallel builtins only native code runs off the main thread,
+// so only a call of a compiled lambda on fixnums, each a number or a global,
+// goes to a worker. Anything else is evaluated there and then by
+// (promise expr), which makes a future already resolved to a value. Futures
+// get a worker of their own even with one thread, so a long call started
+// at the prompt and kept with def runs while the next lines are read.
+// Letting go of one still running waits for it, though, and a future that
+// is only the value of a line is let go of when the next line starts, so
+// that line blocks until the worker is done.
+typedef struct lfuture {
+  lval_t* proc;
+  ljit_fn_t fn;
+  lval_t* args[LFORK_ARGS];
+  long result;
+  atomic_int done;
+} lfuture_t;
+
+static void lfuture_run(void* arg) {
+  lfuture_t* f = arg;
+  f->result = f->fn(f->args, LJIT_DEPTH);
+  atomic_store(&f->done, 1);
+}
+
+// The worker's code must outlive it, so letting go of a future still
+// running waits for it, asleep
+void lfuture_del(lfuture_t* f) {
+  if (!f) { return; }
+  pool_await(&f->done);
+  lval_del(f->proc);
+  free(f);
+}
+
+// The worker state for the call e, or NULL if it can't be run natively
+static lfuture_t* lfuture_find(lval_t* e) {
+  int n = lval_count(e) - 1;
+  if (n < 0 || n > LFORK_ARGS) { return NULL; }
+
+  lval_t* w[LFORK_ARGS + 1];
+  for (int i = 0; i <= n; i++) {
+    w[i] = lval_type(e->cell[i]) == LVAL_SYM ? lenv_get(e->cell[i]->sym) : e->cell[i];
+    if (!w[i] || (i > 0 && !LVAL_IS_FIX(w[i]))) { return NULL; }
+  }
+  if (lval_type(w[0]) != LVAL_FUN || !w[0]->proc) { return NULL; }
+  ljit_fn_t fn = ljit_now(w[0]->proc, n);
+  if (!fn) { return NULL; }
+
+  lfuture_t* f = calloc(1, sizeof(lfuture_t));
+  f->proc = lval_retain(w[0]->proc);
+  f->fn = fn;
+  for (int i = 0; i < n; i++) { f->args[i] = w[i + 1]; }
+  return f;
+}
+
+// A future whose task holds f and v, taking both
+static lval_t* lfuture_new(lfuture_t* f, lval_t* v) {
+  larena_t* a = lctx->alloc;
+  lctx->alloc = NULL;
+  lval_t* t = lval_new(LVAL_TASK, sizeof(lval_t));
+  t->future = f;
+  t->value = lval_promote(v);
+  t->count = f != NULL;
+  lctx->alloc = a;
+  if (t->value != v) { lval_del(v); }
+
+  lval_t* x = lval_new(LVAL_FUTURE, sizeof(lval_t));
+  x->task = lval_copy(t);
+  lval_del(t);
+  return x;
+}
+
+lval_t* builtin_future(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'future' passed incorrect number of arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_QEXPR, "Function 'future' passed incorrect type!");
+
+  lval_t* e = lval_retype(lval_take(x, 0), LVAL_SEXPR);
+  lfuture_t* f = lfuture_find(e);
+  if (!f) { return lval_add(lval_add(lval_sexpr(), lval_sym("promise")), e); }
+
+  lval_t* r = lfuture_new(f, e);
+  pool_async(lfuture_run, f);
+  return lval_add(lval_sexpr(), r);
+}
+
+lval_t* builtin_promise(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'promise' passed incorrect number of arguments!");
+
+  return lfuture_new(NULL, lval_take(x, 0));
+}
+
+// Hands back the value, or the expression when the worker gave up on it.
+// That is only ever pure native code, so running it again is safe.
+lval_t* builtin_await(lval_t* x) {
+  LASSERT(x, x->count == 1, "Function 'await' passed too many arguments!");
+  LASSERT(x, lval_type(x->cell[0]) == LVAL_FUTURE, "Function 'await' passed incorrect type!");
+
+  lval_t* t = x->cell[0]->task;
+  if (t->future) {
+    lfuture_t* f = t->future;
+    pool_await(&f->done);
+    if (f->result) {
+      lval_del(t->value);
+      t->value = (lval_t*)f->result;
+      t->count = 0;
+    }
+    t->future = NULL;
+    lfuture_del(f);
+  }
+
+  lval_t* r = t->count ? lval_copy(t->value) : lval_add(lval_sexpr(), lval_copy(t->value));
+  lval_del(x);
+  return r;
+}
+
+// Run c at the top level, consuming it
+lval_t* lval_run(lcode_t* c) {
+  lvm_t vm = { .prev = lctx->vms };
+  vm.stack = vm.small;
+  vm.stackcap = LVAL_STACK;
+  vm.frames = vm.small_frames;
+  vm.framecap = LVAL_FRAMES;
+  lctx->vms = &vm;
+
+  lval_t** sp = lvm_push(&vm, vm.stack, c, lval_sexpr(), NULL);
+  lframe_t* fr = vm.frames;
+  int* ip = c->code;
+  lval_t* r;
+  lval_t* f;
+  lval_t* env;
+  lval_t* proc;
+  lcode_t* code;
+  int argc;
+  int tail;
+
+#if defined(__GNUC__)
+  // Computed goto: every handler jumps straight to the next one
+  static void* dispatch[] = {
+    [OP_CONST] = &&L_OP_CONST,
+    [OP_ERR] = &&L_OP_ERR,
+    [OP_ARITH] = &&L_OP_ARITH,
+    [OP_BUILTIN] = &&L_OP_BUILTIN,
+    [OP_CALL] = &&L_OP_CALL,
+    [OP_TAILCALL] = &&L_OP_TAILCALL,
+    [OP_JUMP] = &&L_OP_JUMP,
+    [OP_JUMPF] = &&L_OP_JUMPF,
+    [OP_LOCAL] = &&L_OP_LOCAL,
+    [OP_GLOBAL] = &&L_OP_GLOBAL,
+    [OP_CLOSURE] = &&L_OP_CLOSURE,
+    [OP_FORK] = &&L_OP_FORK,
+    [OP_RET] = &&L_OP_RET,
+  };
+#define VM_OP(op) L_##op:
+#define VM_NEXT() goto *dispatch[*ip++]
+  VM_NEXT();
+  {
+#else
+#define VM_OP(op) case op:
+#define VM_NEXT() continue
+  for (;;) switch (*ip++) {
+#endif
+
+  VM_OP(OP_CONST)
+    *sp++ = lval_copy(c->consts[*ip++]);
+    VM_NEXT();
+
+  VM_OP(OP_ERR)
+    r = lval_copy(c->consts[*ip++]);
+    goto unwind;
+
+  VM_OP(OP_ARITH)
+    argc = ip[1];
+    sp -= argc;
+    r = lval_arith(sp, argc, ip[0]);
+    ip += 2;
+    if (lval_type(r) == LVAL_ERR) { goto unwind; }
+    *sp++ = r;
+    VM_NEXT();
+
+  VM_OP(OP_BUILTIN)
+    vm.sp = sp;
+    LGC_SAFEPOINT();
+    argc = ip[1];
+    vm.sp = sp -= argc;
+    r = builtins[ip[0]].fn(lval_args(sp, argc));
+    ip += 2;
+    if (lval_type(r) == LVAL_ERR) { goto unwind; }
+    *sp++ = r;
+    VM_NEXT();
+
+  VM_OP(OP_CALL)
+    tail = 0;
+    goto call;
+
+  VM_OP(OP_TAILCALL)
+    tail = 1;
+  call:
+    vm.sp = sp;
+    LGC_SAFEPOINT();
+    argc = *ip++;
+    sp -= argc + 1;
+    f = *sp;
+    vm.sp = sp;
+    if (lval_type(f) != LVAL_FUN) {
+      for (int i = 0; i < argc; i++) { lval_del(sp[i + 1]); }
+      lval_del(f);
+      r = lval_err("S-expression does not start with function!");
+      goto unwind;
+    }
+
+    if (f->proc) {
+      r = ljit_enter(f->proc, sp + 1, argc);
+      if (r) {
+        lval_del(f);
+        if (tail) { goto ret; }
+        *sp++ = r;
+        VM_NEXT();
+      }
+
+      proc = lval_retain(f->proc);
+      code = proc->code;
+      env = lval_bind(f, sp + 1, argc);
+      if (lval_type(env) == LVAL_ERR) {
+        lval_del(proc);
+        r = env;
+        goto unwind;
+      }
+    } else {
+      // Builtins either answer directly or hand back code to run here
+      int id = f->count;
+      r = builtins[id].fn(lval_args(sp + 1, argc));
+      if (lval_type(r) == LVAL_ERR) { goto unwind; }
+      if (!builtins[id].evals) {
+        *sp++ = r;
+        VM_NEXT();
+      }
+      proc = NULL;
+      code = lval_compile(r);
+      lval_del(r);
+      env = lval_sexpr();
+    }
+
+    // A call in tail position has nothing of its caller left on the stack,
+    // so the caller's frame is dropped rather than kept to return to
+    if (tail) {
+      lvm_pop(&vm);
+    } else {
+      fr->ip = ip;
+    }
+    sp = lvm_push(&vm, sp, code, env, proc);
+    fr = &vm.frames[vm.nframes - 1];
+    c = code;
+    ip = c->code;
+    VM_NEXT();
+
+  VM_OP(OP_JUMP)
+    ip = c->code + *ip;
+    VM_NEXT();
+
+  VM_OP(OP_JUMPF)
+    r = *--sp;
+    if (!lval_is_num(r)) {
+      lval_del(r);
+      r = lval_err("Function 'if' passed incorrect type!");
+      goto unwind;
+    }
+    ip = lval_true(r) ? ip + 1 : c->code + *ip;
+    lval_del(r);
+    VM_NEXT();
+
+  VM_OP(OP_LOCAL)
+    r = fr->env;
+    for (int d = ip[0]; d > 0; d--) { r = r->cell[0]; }
+    *sp++ = lval_copy(r->cell[ip[1] + 1]);
+    ip += 2;
+    VM_NEXT();
+
+  VM_OP(OP_GLOBAL)
+    r = lcode_global(c, ip);
+    ip += 2;
+    if (!r) {
+      r = lval_unbound(c->consts[ip[-2]]->sym);
+      goto unwind;
+    }
+    *sp++ = lval_copy(r);
+    VM_NEXT();
+
+  VM_OP(OP_FORK)
+    if (lfork_run(c, fr->env, ip, sp)) {
+      sp += ip[0];
+      ip = c->code + ip[1];
+    } else {
+      ip += 2;
+    }
+    VM_NEXT();
+
+  VM_OP(OP_CLOSURE)
+    *sp++ = lval_lambda(c->consts[*ip++], lval_copy(fr->env));
+    VM_NEXT();
+
+  VM_OP(OP_RET)
+    r = *--sp;
+  ret:
+    sp = vm.stack + fr->base;
+    lvm_pop(&vm);
+    if (vm.nframes == 0) { goto done; }
+    fr = &vm.frames[vm.nframes - 1];
+    c = fr->code;
+    ip = fr->ip;
+    *sp++ = r;
+    VM_NEXT();
+
+  }
+#undef VM_NEXT
+#undef VM_OP
+
+unwind:
+  // Evaluation stops at the first error, dropping every frame
+  while (sp > vm.stack) { lval_del(*--sp); }
+  while (vm.nframes) { lvm_pop(&vm); }
+
+done:
+  lctx->vms = vm.prev;
+  if (vm.stack != vm.small) { free(vm.stack); }
+  if (vm.frames != vm.small_frames) { free(vm.frames); }
+  return r;
+}
+
+lval_t* lval_eval(lval_t* x) {
+  lcode_t* c = lval_compile(x);
+  lval_del(x);
+  return lval_run(c);
+}
+
+static void lprocess_init(void) {
+  lbuiltins_init();
+  pool_init();
+  dbl_init();
+  larith_init();
+  vec_init();
+  mat_init();
+  ljit_init();
+}
+
+// Without threads on Windows, only one thread ever makes contexts
+#ifndef _WIN32
+static pthread_once_t lprocess_once = PTHREAD_ONCE_INIT;
+#else
+static int lprocess_done = 0;
+#endif
+
+// The context is current while it is set up, as for every other call on it
+flispy_ctx_t* flispy_new(void) {
+#ifndef _WIN32
+  pthread_once(&lprocess_once, lprocess_init);
+#else
+  if (!lprocess_done) {
+    lprocess_init();
+    lprocess_done = 1;
+  }
+#endif
+
+  static const char* names[LCTX_RULES] = {
+    "double", "number", "vector", "symbol", "sexpr", "qexpr", "expr", "flispy",
+  };
+  flispy_ctx_t* ctx = calloc(1, sizeof(flispy_ctx_t));
+  flispy_ctx_t* prev = lctx;
+  lctx = ctx;
+  mpc_parser_t** r = ctx->rules;
+  for (int i = 0; i < LCTX_RULES; i++) { r[i] = mpc_new(names[i]); }
+
+  mpca_lang(MPCA_LANG_DEFAULT, "\
+        double : /-?[0-9]+(\\.[0-9]+)?[eE][-+]?[0-9]+|-?[0-9]+\\.[0-9]+/ ; \
+        number : /-?[0-9]+/ ; \
+        vector : '[' (<double> | <number> | <vector>)* ']' ; \
+        symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ; \
+        sexpr : '(' <expr>* ')' ; \
+        qexpr : '{' <expr>* '}' ; \
+        expr : <double> | <number> | <vector> | <symbol> | <sexpr> | <qexpr> ;\
+        flispy: /^/ <expr>* /$/;\
+      ",
+      r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+
+  lbuiltins_intern();
+  lgc_init();
+  lic_init();
+  lctx = prev;
+  return ctx;
+}
+
+// Let go of the last line's value and everything else it made
+static void lctx_release(flispy_ctx_t* ctx) {
+  if (ctx->result) { lval_del(ctx->result); }
+  ctx->result = NULL;
+  larena_reset(&ctx->arena);
+  lgc_reset();
+  lic_reset();
+}
+
+// Globals go first, since dropping them can queue lists for the collector
+// and futures for their workers
+void flispy_free(flispy_ctx_t* ctx) {
+  if (!ctx) { return; }
+  flispy_ctx_t* prev = lctx;
+  lctx = ctx;
+  lctx_release(ctx);
+  lenv_free();
+  lgc_free();
+  larena_free(&ctx->arena);
+  free(ctx->arena.pins);
+  lsym_free();
+
+  mpc_parser_t** r = ctx->rules;
+  mpc_cleanup(LCTX_RULES, r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+  free(ctx);
+  lctx = prev;
+}
+
+flispy_val_t* flispy_eval(flispy_ctx_t* ctx, const char* src, size_t len) {
+  flispy_ctx_t* prev = lctx;
+  lctx = ctx;
+  lctx_release(ctx);
+
+  mpc_result_t r;
+  ctx->alloc = &ctx->arena;
+  if (mpc_nparse("<input>", src, len, ctx->rules[LCTX_RULES - 1], &r)) {
+    ctx->result = lval_eval(lval_read(r.output));
+    mpc_ast_delete(r.output);
+  } else {
+    char* m = mpc_err_string(r.error);
+    m[strcspn(m, "\n")] = '\0';
+    ctx->result = lval_err(m);
+    free(m);
+    mpc_err_delete(r.error);
+  }
+  ctx->alloc = NULL;
+  lctx = prev;
+  return ctx->result;
+}
+
+// Procs and tasks are never handed out
+int flispy_type(flispy_val_t* v) {
+  switch (lval_type(v)) {
+    case LVAL_NUM: return FLISPY_NUMBER;
+    case LVAL_DBL: return FLISPY_DOUBLE;
+    case LVAL_VEC: return FLISPY_VECTOR;
+    case LVAL_ERR: return FLISPY_ERROR;
+    case LVAL_SYM: return FLISPY_SYMBOL;
+    case LVAL_SEXPR: return FLISPY_SEXPR;
+    case LVAL_QEXPR: return FLISPY_QEXPR;
+    case LVAL_FUN: return FLISPY_FUNCTION;
+    default: return FLISPY_FUTURE;
+  }
+}
+
+long flispy_long(flispy_val_t* v) {
+  return lval_type(v) == LVAL_NUM && !lval_is_big(v) ? lval_long(v) : 0;
+}
+
+double flispy_double(flispy_val_t* v) {
+  return lval_is_num(v) ? lval_double(v) : 0;
+}
+
+const char* flispy_string(flispy_val_t* v) {
+  if (lval_type(v) == LVAL_ERR) { return v->err; }
+  if (lval_type(v) == LVAL_SYM) { return v->sym->name; }
+  return NULL;
+}
+
+int flispy_count(flispy_val_t* v) {
+  int t = lval_type(v);
+  return t == LVAL_SEXPR || t == LVAL_QEXPR || t == LVAL_VEC ? lval_count(v) : 0;
+}
+
+flispy_val_t* flispy_item(flispy_val_t* v, int i) {
+  int t = lval_type(v);
+  if ((t != LVAL_SEXPR && t != LVAL_QEXPR) || i < 0 || i >= lval_count(v)) { return NULL; }
+  return v->cell[i];
+}
+
+const long* flispy_longs(flispy_val_t* v) {
+  return lval_type(v) == LVAL_VEC && !lvec_dbl(v) ? v->ivec : NULL;
+}
+
+const double* flispy_doubles(flispy_val_t* v) {
+  return lval_type(v) == LVAL_VEC && lvec_dbl(v) ? v->dvec : NULL;
+}
+
+int flispy_cols(flispy_val_t* v) {
+  return lval_type(v) == LVAL_VEC && (v->flags & LVAL_MATRIX) ? LMAT_COLS(v) : 0;
+}
+
+void flispy_println(flispy_val_t* v) {
+  lval_println(v);
+}
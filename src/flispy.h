@@ -0,0 +1,67 @@
+#ifndef FLISPY_H
+#define FLISPY_H
+
+#include <stddef.h>
+
+// Embedding
+//
+// A context is a whole interpreter, with the grammar built once when it is
+// made. Contexts share nothing, so a thread can keep several and threads
+// can each run their own at once. A context can also be handed from one
+// thread to another, as long as only one uses it at a time.
+//
+// flispy_eval reads source straight from the caller's buffer, which needs no
+// terminator and is not copied. The value it hands back lives in the
+// context and stays valid until the next flispy_eval or flispy_free on it.
+// Nothing is copied out of values either: strings and vector elements point
+// into them.
+#if defined(__GNUC__)
+#define FLISPY_API __attribute__((visibility("default")))
+#else
+#define FLISPY_API
+#endif
+
+typedef struct flispy_ctx flispy_ctx_t;
+typedef struct lval flispy_val_t;
+
+enum {
+  FLISPY_NUMBER, FLISPY_DOUBLE, FLISPY_VECTOR, FLISPY_ERROR, FLISPY_SYMBOL,
+  FLISPY_SEXPR, FLISPY_QEXPR, FLISPY_FUNCTION, FLISPY_FUTURE,
+};
+
+// A new interpreter with nothing defined but the builtins
+FLISPY_API flispy_ctx_t* flispy_new(void);
+FLISPY_API void flispy_free(flispy_ctx_t* ctx);
+
+// The value of the len bytes of source at src, evaluated as one line of the
+// REPL. Source that doesn't parse gives an error.
+FLISPY_API flispy_val_t* flispy_eval(flispy_ctx_t* ctx, const char* src, size_t len);
+
+FLISPY_API int flispy_type(flispy_val_t* v);
+
+// A number that fits in a long, or 0
+FLISPY_API long flispy_long(flispy_val_t* v);
+
+// Any number, or 0
+FLISPY_API double flispy_double(flispy_val_t* v);
+
+// The message of an error or the name of a symbol, or NULL
+FLISPY_API const char* flispy_string(flispy_val_t* v);
+
+// Items in a list, or elements in a vector, row after row for a matrix
+FLISPY_API int flispy_count(flispy_val_t* v);
+
+// Item i of a list, or NULL if v is not a list or i is not in [0, count)
+FLISPY_API flispy_val_t* flispy_item(flispy_val_t* v, int i);
+
+// A vector's elements, or NULL unless they are of that type
+FLISPY_API const long* flispy_longs(flispy_val_t* v);
+FLISPY_API const double* flispy_doubles(flispy_val_t* v);
+
+// Columns of a matrix, or 0 for anything else
+FLISPY_API int flispy_cols(flispy_val_t* v);
+
+// Print v on stdout as the REPL does
+FLISPY_API void flispy_println(flispy_val_t* v);
+
+#endif
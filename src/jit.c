@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_X86 1
+#endif
+
+static void jit_byte(jit_t* j, int b) {
+  if (j->count == j->cap) {
+    j->cap = j->cap ? j->cap * 2 : 256;
+    j->code = realloc(j->code, j->cap);
+  }
+  j->code[j->count++] = (unsigned char)b;
+}
+
+static void jit_int32(jit_t* j, int x) {
+  for (int i = 0; i < 4; i++) { jit_byte(j, (unsigned)x >> (8 * i) & 0xff); }
+}
+
+// Encoding
+//
+// Every instruction here takes a REX prefix with W set for 64 bit operands,
+// carrying the top bit of each register number.
+static void jit_rex(jit_t* j, int reg, int rm) {
+  jit_byte(j, 0x48 | (reg >> 3) << 2 | rm >> 3);
+}
+
+// Register to register
+static void jit_modrm_reg(jit_t* j, int reg, int rm) {
+  jit_byte(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// [base + disp32]. rsp and r12 as a base can only be written with an SIB
+// byte.
+static void jit_modrm_mem(jit_t* j, int reg, int base, int disp) {
+  jit_byte(j, 0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == JIT_RSP) { jit_byte(j, 0x24); }
+  jit_int32(j, disp);
+}
+
+void jit_load(jit_t* j, int dst, int base, int disp) {
+  jit_rex(j, dst, base);
+  jit_byte(j, 0x8b);
+  jit_modrm_mem(j, dst, base, disp);
+}
+
+void jit_store(jit_t* j, int base, int disp, int src) {
+  jit_rex(j, src, base);
+  jit_byte(j, 0x89);
+  jit_modrm_mem(j, src, base, disp);
+}
+
+void jit_lea(jit_t* j, int dst, int base, int disp) {
+  jit_rex(j, dst, base);
+  jit_byte(j, 0x8d);
+  jit_modrm_mem(j, dst, base, disp);
+}
+
+void jit_mov(jit_t* j, int dst, int src) {
+  jit_rex(j, src, dst);
+  jit_byte(j, 0x89);
+  jit_modrm_reg(j, src, dst);
+}
+
+void jit_imm(jit_t* j, int dst, long imm) {
+  jit_rex(j, 0, dst);
+  jit_byte(j, 0xb8 | (dst & 7));
+  for (int i = 0; i < 8; i++) { jit_byte(j, (unsigned long)imm >> (8 * i) & 0xff); }
+}
+
+void jit_alu(jit_t* j, int op, int dst, int src) {
+  jit_rex(j, src, dst);
+  jit_byte(j, op << 3 | 1);
+  jit_modrm_reg(j, src, dst);
+}
+
+void jit_alu_imm(jit_t* j, int op, int dst, int imm) {
+  jit_rex(j, 0, dst);
+  jit_byte(j, 0x81);
+  jit_modrm_reg(j, op, dst);
+  jit_int32(j, imm);
+}
+
+void jit_test_imm(jit_t* j, int dst, int imm) {
+  jit_rex(j, 0, dst);
+  jit_byte(j, 0xf7);
+  jit_modrm_reg(j, 0, dst);
+  jit_int32(j, imm);
+}
+
+void jit_imul(jit_t* j, int dst, int src) {
+  jit_rex(j, dst, src);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0xaf);
+  jit_modrm_reg(j, dst, src);
+}
+
+void jit_sar1(jit_t* j, int dst) {
+  jit_rex(j, 0, dst);
+  jit_byte(j, 0xd1);
+  jit_modrm_reg(j, 7, dst);
+}
+
+void jit_idiv(jit_t* j, int src) {
+  jit_byte(j, 0x48);
+  jit_byte(j, 0x99);
+  jit_rex(j, 0, src);
+  jit_byte(j, 0xf7);
+  jit_modrm_reg(j, 7, src);
+}
+
+// setcc on the low byte, then zero extended to the whole register
+void jit_setcc(jit_t* j, int cond, int dst) {
+  jit_byte(j, 0x40 | dst >> 3);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0x90 | cond);
+  jit_modrm_reg(j, 0, dst);
+  jit_rex(j, dst, dst);
+  jit_byte(j, 0x0f);
+  jit_byte(j, 0xb6);
+  jit_modrm_reg(j, dst, dst);
+}
+
+void jit_push(jit_t* j, int src) {
+  if (src >> 3) { jit_byte(j, 0x41); }
+  jit_byte(j, 0x50 | (src & 7));
+}
+
+void jit_pop(jit_t* j, int dst) {
+  if (dst >> 3) { jit_byte(j, 0x41); }
+  jit_byte(j, 0x58 | (dst & 7));
+}
+
+void jit_ret(jit_t* j) {
+  jit_byte(j, 0xc3);
+}
+
+// Targets are always given as 32 bit offsets, so no jump needs resizing
+int jit_jump(jit_t* j, int cond) {
+  if (cond == JIT_ALWAYS) {
+    jit_byte(j, 0xe9);
+  } else {
+    jit_byte(j, 0x0f);
+    jit_byte(j, 0x80 | cond);
+  }
+  jit_int32(j, 0);
+  return j->count - 4;
+}
+
+int jit_call(jit_t* j) {
+  jit_byte(j, 0xe8);
+  jit_int32(j, 0);
+  return j->count - 4;
+}
+
+void jit_patch(jit_t* j, int at, int to) {
+  int rel = to - (at + 4);
+  memcpy(j->code + at, &rel, 4);
+}
+
+int jit_supported(void) {
+#ifdef JIT_X86
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void* jit_finish(jit_t* j, size_t* size) {
+  void* p = NULL;
+#ifdef JIT_X86
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  *size = ((size_t)j->count + page - 1) / page * page;
+  p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    p = NULL;
+  } else {
+    memcpy(p, j->code, j->count);
+    if (mprotect(p, *size, PROT_READ | PROT_EXEC) != 0) {
+      munmap(p, *size);
+      p = NULL;
+    }
+  }
+#else
+  *size = 0;
+#endif
+  free(j->code);
+  j->code = NULL;
+  j->count = j->cap = 0;
+  return p;
+}
+
+void jit_release(void* code, size_t size) {
+#ifdef JIT_X86
+  if (code) { munmap(code, size); }
+#else
+  (void)code;
+  (void)size;
+#endif
+}
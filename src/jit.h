@@ -0,0 +1,66 @@
+#ifndef FLISPY_JIT_H
+#define FLISPY_JIT_H
+
+#include <stddef.h>
+
+// A small x86-64 assembler
+//
+// Instructions are appended to a growable buffer, and jit_finish copies the
+// result to pages of its own, which are made executable and are never
+// writable again. Only the handful of instructions the JIT's templates need
+// are here, all on 64 bit registers. Memory operands are [base + disp].
+typedef struct {
+  unsigned char* code;
+  int count;
+  int cap;
+} jit_t;
+
+enum {
+  JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+  JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+// ALU operations, numbered as their x86 opcode extensions
+enum { JIT_ADD = 0, JIT_OR = 1, JIT_AND = 4, JIT_SUB = 5, JIT_XOR = 6, JIT_CMP = 7 };
+
+// Condition codes
+enum { JIT_O = 0, JIT_E = 4, JIT_NE = 5, JIT_L = 12, JIT_GE = 13, JIT_LE = 14, JIT_G = 15, JIT_ALWAYS = -1 };
+
+// Whether this build can make native code at all
+int jit_supported(void);
+
+void jit_load(jit_t* j, int dst, int base, int disp);
+void jit_store(jit_t* j, int base, int disp, int src);
+void jit_lea(jit_t* j, int dst, int base, int disp);
+void jit_mov(jit_t* j, int dst, int src);
+void jit_imm(jit_t* j, int dst, long imm);
+
+// dst op= src, or dst op= imm
+void jit_alu(jit_t* j, int op, int dst, int src);
+void jit_alu_imm(jit_t* j, int op, int dst, int imm);
+void jit_test_imm(jit_t* j, int dst, int imm);
+void jit_imul(jit_t* j, int dst, int src);
+void jit_sar1(jit_t* j, int dst);
+
+// rdx:rax divided by src after sign extending rax, quotient in rax and
+// remainder in rdx
+void jit_idiv(jit_t* j, int src);
+
+// dst = 1 if cond holds, otherwise 0
+void jit_setcc(jit_t* j, int cond, int dst);
+
+void jit_push(jit_t* j, int src);
+void jit_pop(jit_t* j, int dst);
+void jit_ret(jit_t* j);
+
+// Jumps and calls return where their target goes, to fill in with jit_patch
+// once it is known
+int jit_jump(jit_t* j, int cond);
+int jit_call(jit_t* j);
+void jit_patch(jit_t* j, int at, int to);
+
+// Executable copy of the code, or NULL. The buffer is freed either way.
+void* jit_finish(jit_t* j, size_t* size);
+void jit_release(void* code, size_t size);
+
+#endif
@@ -0,0 +1,222 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vec.h"
+#include "mat.h"
+#include "pool.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MAT_X86 1
+#endif
+
+// Blocking
+//
+// A block of b is MAT_KB rows by MAT_JB columns, 128 KiB of doubles, which
+// stays in L2 while every row of a runs over it. Blocks of k are taken in
+// order so each element of c still gets its products added from k = 0 up.
+#define MAT_KB 128
+#define MAT_JB 128
+
+// Products below this many multiplies aren't worth starting threads for
+#define MAT_THREAD_MIN (1L << 21)
+#define MAT_THREADS_MAX 16
+
+static int mat_threads = 1;
+
+static int mul_overflow(long a, long b, long* r) {
+#ifdef __GNUC__
+  return __builtin_mul_overflow(a, b, r);
+#else
+  if (a != 0 && b != 0) {
+    if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a)
+              : (b > 0 ? a < LONG_MIN / b : a < LONG_MAX / b)) { return 1; }
+  }
+  *r = a * b;
+  return 0;
+#endif
+}
+
+// Plain versions
+//
+// Each works out rows i0 to i1 of c, which must start zeroed.
+static void block_d_c(double* c, const double* a, const double* b,
+  int i0, int i1, int k0, int k1, int j0, int j1, int k, int m) {
+  for (int i = i0; i < i1; i++) {
+    double* ci = c + (size_t)i * m;
+    for (int p = k0; p < k1; p++) {
+      double x = a[(size_t)i * k + p];
+      const double* bp = b + (size_t)p * m;
+      for (int j = j0; j < j1; j++) { ci[j] += x * bp[j]; }
+    }
+  }
+}
+
+// Overflow is collected in the sign bit of ovf, as in vec.c
+static int block_l(long* c, const long* a, const long* b,
+  int i0, int i1, int k0, int k1, int j0, int j1, int k, int m) {
+  long ovf = 0;
+  for (int i = i0; i < i1; i++) {
+    long* ci = c + (size_t)i * m;
+    for (int p = k0; p < k1; p++) {
+      long x = a[(size_t)i * k + p];
+      const long* bp = b + (size_t)p * m;
+      for (int j = j0; j < j1; j++) {
+        long t = 0;
+        ovf |= -(long)mul_overflow(x, bp[j], &t);
+        long s = (long)((unsigned long)ci[j] + (unsigned long)t);
+        ovf |= (ci[j] ^ s) & (t ^ s);
+        ci[j] = s;
+      }
+    }
+  }
+  return ovf < 0 ? VEC_OVERFLOW : VEC_OK;
+}
+
+#ifdef MAT_X86
+// AVX2 version
+//
+// A tile of c four rows by eight columns lives in eight registers for the
+// whole of a block of k. Multiplies and adds are kept separate, since a
+// fused multiply add rounds differently from the plain version.
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void block_d_avx2(double* c, const double* a, const double* b,
+  int i0, int i1, int k0, int k1, int j0, int j1, int k, int m) {
+  int i = i0;
+  for (; i + 4 <= i1; i += 4) {
+    const double* a0 = a + (size_t)i * k;
+    const double* a1 = a0 + k;
+    const double* a2 = a1 + k;
+    const double* a3 = a2 + k;
+    int j = j0;
+    for (; j + 8 <= j1; j += 8) {
+      double* c0 = c + (size_t)i * m + j;
+      double* c1 = c0 + m;
+      double* c2 = c1 + m;
+      double* c3 = c2 + m;
+      __m256d t00 = _mm256_loadu_pd(c0), t01 = _mm256_loadu_pd(c0 + 4);
+      __m256d t10 = _mm256_loadu_pd(c1), t11 = _mm256_loadu_pd(c1 + 4);
+      __m256d t20 = _mm256_loadu_pd(c2), t21 = _mm256_loadu_pd(c2 + 4);
+      __m256d t30 = _mm256_loadu_pd(c3), t31 = _mm256_loadu_pd(c3 + 4);
+      for (int p = k0; p < k1; p++) {
+        const double* bp = b + (size_t)p * m + j;
+        __m256d y0 = _mm256_loadu_pd(bp), y1 = _mm256_loadu_pd(bp + 4);
+        __m256d x = _mm256_broadcast_sd(a0 + p);
+        t00 = _mm256_add_pd(t00, _mm256_mul_pd(x, y0));
+        t01 = _mm256_add_pd(t01, _mm256_mul_pd(x, y1));
+        x = _mm256_broadcast_sd(a1 + p);
+        t10 = _mm256_add_pd(t10, _mm256_mul_pd(x, y0));
+        t11 = _mm256_add_pd(t11, _mm256_mul_pd(x, y1));
+        x = _mm256_broadcast_sd(a2 + p);
+        t20 = _mm256_add_pd(t20, _mm256_mul_pd(x, y0));
+        t21 = _mm256_add_pd(t21, _mm256_mul_pd(x, y1));
+        x = _mm256_broadcast_sd(a3 + p);
+        t30 = _mm256_add_pd(t30, _mm256_mul_pd(x, y0));
+        t31 = _mm256_add_pd(t31, _mm256_mul_pd(x, y1));
+      }
+      _mm256_storeu_pd(c0, t00); _mm256_storeu_pd(c0 + 4, t01);
+      _mm256_storeu_pd(c1, t10); _mm256_storeu_pd(c1 + 4, t11);
+      _mm256_storeu_pd(c2, t20); _mm256_storeu_pd(c2 + 4, t21);
+      _mm256_storeu_pd(c3, t30); _mm256_storeu_pd(c3 + 4, t31);
+    }
+    if (j < j1) { block_d_c(c, a, b, i, i + 4, k0, k1, j, j1, k, m); }
+  }
+  if (i < i1) { block_d_c(c, a, b, i, i1, k0, k1, j0, j1, k, m); }
+}
+#endif
+
+static void (*block_d)(double*, const double*, const double*,
+  int, int, int, int, int, int, int, int) = block_d_c;
+
+// Rows i0 to i1 of c, a block of b at a time
+typedef struct {
+  void* c;
+  const void* a;
+  const void* b;
+  int i0, i1, k, m;
+  int dbl;
+  int status;
+} mat_job_t;
+
+static void mat_rows(mat_job_t* job) {
+  int k = job->k, m = job->m;
+  job->status = VEC_OK;
+  for (int j0 = 0; j0 < m; j0 += MAT_JB) {
+    int j1 = j0 + MAT_JB < m ? j0 + MAT_JB : m;
+    for (int k0 = 0; k0 < k; k0 += MAT_KB) {
+      int k1 = k0 + MAT_KB < k ? k0 + MAT_KB : k;
+      if (job->dbl) {
+        block_d(job->c, job->a, job->b, job->i0, job->i1, k0, k1, j0, j1, k, m);
+      } else {
+        job->status |= block_l(job->c, job->a, job->b, job->i0, job->i1, k0, k1, j0, j1, k, m);
+      }
+    }
+  }
+}
+
+static void mat_task(void* arg) {
+  mat_rows(arg);
+}
+
+// Split the rows of c between the pool's threads, keeping tiles of four
+// rows whole. The calling thread takes the first share itself.
+static int mat_mul(void* c, const void* a, const void* b, int n, int k, int m, int dbl) {
+  memset(c, 0, (size_t)n * m * sizeof(long));
+  if (n == 0 || m == 0) { return VEC_OK; }
+
+  int t = 1;
+  if ((double)n * k * m >= MAT_THREAD_MIN) {
+    t = mat_threads < (n + 3) / 4 ? mat_threads : (n + 3) / 4;
+  }
+
+  mat_job_t jobs[MAT_THREADS_MAX];
+  int per = ((n + t - 1) / t + 3) / 4 * 4;
+  int used = 0;
+  for (int i0 = 0; i0 < n; i0 += per) {
+    jobs[used++] = (mat_job_t){ c, a, b, i0, i0 + per < n ? i0 + per : n, k, m, dbl, VEC_OK };
+  }
+
+  pool_group_t g = { 0 };
+  for (int i = 1; i < used; i++) { pool_spawn(&g, mat_task, &jobs[i]); }
+  mat_rows(&jobs[0]);
+  pool_wait(&g);
+
+  int status = VEC_OK;
+  for (int i = 0; i < used; i++) { status |= jobs[i].status; }
+  return status;
+}
+
+void mat_init(void) {
+#ifdef MAT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) { block_d = block_d_avx2; }
+#endif
+
+  int t = pool_threads();
+  mat_threads = t > MAT_THREADS_MAX ? MAT_THREADS_MAX : t;
+}
+
+void mat_mul_d(double* c, const double* a, const double* b, int n, int k, int m) {
+  mat_mul(c, a, b, n, k, m, 1);
+}
+
+int mat_mul_l(long* c, const long* a, const long* b, int n, int k, int m) {
+  return mat_mul(c, a, b, n, k, m, 0);
+}
+
+// Tiles of 32 by 32, so both the rows read and the rows written stay in L1
+#define MAT_TB 32
+
+void mat_transpose(long* r, const long* a, int rows, int cols) {
+  for (int i0 = 0; i0 < rows; i0 += MAT_TB) {
+    int i1 = i0 + MAT_TB < rows ? i0 + MAT_TB : rows;
+    for (int j0 = 0; j0 < cols; j0 += MAT_TB) {
+      int j1 = j0 + MAT_TB < cols ? j0 + MAT_TB : cols;
+      for (int i = i0; i < i1; i++) {
+        for (int j = j0; j < j1; j++) { r[(size_t)j * rows + i] = a[(size_t)i * cols + j]; }
+      }
+    }
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef FLISPY_MAT_H
+#define FLISPY_MAT_H
+
+// Kernels over row major matrices of longs or doubles
+//
+// Products are worked out a cache sized block at a time, with an AVX2
+// register tile when the CPU has it, and big ones are split by rows across
+// threads. Each element is still summed in order of k, so the answer is the
+// same however the work was divided.
+void mat_init(void);
+
+// c = a b, where a is n by k, b is k by m and c is n by m
+void mat_mul_d(double* c, const double* a, const double* b, int n, int k, int m);
+
+// As mat_mul_d, returning VEC_OVERFLOW if any sum or product overflows
+int mat_mul_l(long* c, const long* a, const long* b, int n, int k, int m);
+
+// r is a transposed, where a is rows by cols. Elements are only moved, so
+// this serves doubles too.
+void mat_transpose(long* r, const long* a, int rows, int cols);
+
+#endif
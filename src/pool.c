@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "pool.h"
+
+#define POOL_THREADS_MAX 64
+
+typedef struct {
+  void (*fn)(void*);
+  void* arg;
+  pool_group_t* group;
+} pool_task_t;
+
+static int pool_nthreads = 1;
+
+#ifndef _WIN32
+// Deques
+//
+// A ring of tasks from top to bottom under a lock of its own. The indices
+// only ever grow, and wrap by the capacity, which is a power of two.
+typedef struct {
+  pthread_mutex_t lock;
+  pool_task_t* tasks;
+  size_t top;
+  size_t bottom;
+  size_t cap;
+} pool_deque_t;
+
+// Deque 0 is shared by threads outside the pool, and worker i owns deque i.
+// Async tasks have a queue of their own, taken from only by idle workers,
+// so that a thread waiting on a group never ends up running one.
+static pool_deque_t pool_deques[POOL_THREADS_MAX];
+static pool_deque_t pool_asyncs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static _Thread_local int pool_self = 0;
+static atomic_int pool_workers;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+// Tasks pushed and not yet taken, which idle workers sleep on under
+// pool_wake. Waiters with nothing to help with sleep on pool_done, which is
+// signalled when a group empties or an async task finishes.
+static atomic_int pool_queued;
+static atomic_int pool_async_queued;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static void deque_push(pool_deque_t* d, pool_task_t t) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top == d->cap) {
+    size_t cap = d->cap ? d->cap * 2 : 64;
+    pool_task_t* tasks = malloc(sizeof(pool_task_t) * cap);
+    for (size_t i = d->top; i < d->bottom; i++) {
+      tasks[i & (cap - 1)] = d->tasks[i & (d->cap - 1)];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->cap = cap;
+  }
+  d->tasks[d->bottom++ & (d->cap - 1)] = t;
+  pthread_mutex_unlock(&d->lock);
+}
+
+// The owner takes its newest task, a thief the oldest
+static int deque_take(pool_deque_t* d, int steal, pool_task_t* t) {
+  int found = 0;
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom != d->top) {
+    *t = steal ? d->tasks[d->top++ & (d->cap - 1)] : d->tasks[--d->bottom & (d->cap - 1)];
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// A task from our own deque, or else stolen from the others in turn
+static int pool_find(pool_task_t* t) {
+  if (atomic_load(&pool_queued) == 0) { return 0; }
+
+  int n = atomic_load(&pool_workers) + 1;
+  for (int i = 0; i < n; i++) {
+    int victim = (pool_self + i) % n;
+    if (deque_take(&pool_deques[victim], victim != pool_self || pool_self == 0, t)) {
+      atomic_fetch_sub(&pool_queued, 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void pool_signal(void) {
+  pthread_mutex_lock(&pool_lock);
+  pthread_cond_broadcast(&pool_done);
+  pthread_mutex_unlock(&pool_lock);
+}
+#endif
+
+// The group is read first, since a task with none may free what it is part
+// of. Whoever waits is woken once the last task of a group or any async
+// task is done.
+static void pool_run(pool_task_t* t) {
+  pool_group_t* g = t->group;
+  t->fn(t->arg);
+#ifndef _WIN32
+  if (!g || atomic_fetch_sub(&g->pending, 1) == 1) { pool_signal(); }
+#else
+  if (g) { atomic_fetch_sub(&g->pending, 1); }
+#endif
+}
+
+#ifndef _WIN32
+// Group tasks come first, and async ones only when there are none
+static void* pool_worker(void* arg) {
+  pool_self = (int)(intptr_t)arg;
+  pool_task_t t;
+  for (;;) {
+    if (pool_find(&t)) {
+      pool_run(&t);
+      continue;
+    }
+    if (atomic_load(&pool_async_queued) > 0 && deque_take(&pool_asyncs, 1, &t)) {
+      atomic_fetch_sub(&pool_async_queued, 1);
+      pool_run(&t);
+      continue;
+    }
+    pthread_mutex_lock(&pool_lock);
+    while (atomic_load(&pool_queued) == 0 && atomic_load(&pool_async_queued) == 0) {
+      pthread_cond_wait(&pool_wake, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+  return NULL;
+}
+
+// At least one worker, so there is always someone to take async tasks
+static void pool_start(void) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (int i = 1; i < (pool_nthreads > 1 ? pool_nthreads : 2); i++) {
+    pthread_t id;
+    if (pthread_create(&id, &attr, pool_worker, (void*)(intptr_t)i) != 0) { break; }
+    atomic_store(&pool_workers, i);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static void pool_push(pool_task_t t) {
+  int async = t.group == NULL;
+  atomic_fetch_add(async ? &pool_async_queued : &pool_queued, 1);
+  deque_push(async ? &pool_asyncs : &pool_deques[pool_self], t);
+  pthread_mutex_lock(&pool_lock);
+  pthread_cond_signal(&pool_wake);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+// Run group tasks until the group empties or *done is set, sleeping when
+// there are none to run. Tasks pushed while we sleep go to the workers.
+static void pool_block(atomic_int* pending, atomic_int* done) {
+  pool_task_t t;
+  for (;;) {
+    if (pending ? atomic_load(pending) == 0 : atomic_load(done) != 0) { return; }
+    if (pool_find(&t)) {
+      pool_run(&t);
+      continue;
+    }
+    pthread_mutex_lock(&pool_lock);
+    while ((pending ? atomic_load(pending) != 0 : atomic_load(done) == 0)
+           && atomic_load(&pool_queued) == 0) {
+      pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+}
+#endif
+
+void pool_init(void) {
+#ifndef _WIN32
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  char* s = getenv("FLISPY_THREADS");
+  if (s && atol(s) > 0) { cpus = atol(s); }
+  pool_nthreads = cpus < 1 ? 1 : cpus > POOL_THREADS_MAX ? POOL_THREADS_MAX : (int)cpus;
+  for (int i = 0; i < POOL_THREADS_MAX; i++) { pthread_mutex_init(&pool_deques[i].lock, NULL); }
+#endif
+}
+
+int pool_threads(void) {
+  return pool_nthreads;
+}
+
+void pool_spawn(pool_group_t* g, void (*fn)(void*), void* arg) {
+  pool_task_t t = { fn, arg, g };
+  atomic_fetch_add(&g->pending, 1);
+
+#ifndef _WIN32
+  if (pool_nthreads > 1) { pthread_once(&pool_once, pool_start); }
+  if (atomic_load(&pool_workers) > 0) {
+    pool_push(t);
+    return;
+  }
+#endif
+
+  pool_run(&t);
+}
+
+void pool_async(void (*fn)(void*), void* arg) {
+  pool_task_t t = { fn, arg, NULL };
+
+#ifndef _WIN32
+  pthread_once(&pool_once, pool_start);
+  if (atomic_load(&pool_workers) > 0) {
+    pool_push(t);
+    return;
+  }
+#endif
+
+  pool_run(&t);
+}
+
+void pool_wait(pool_group_t* g) {
+#ifndef _WIN32
+  pool_block(&g->pending, NULL);
+#else
+  (void)g;
+#endif
+}
+
+void pool_await(atomic_int* done) {
+#ifndef _WIN32
+  pool_block(NULL, done);
+#else
+  (void)done;
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef FLISPY_POOL_H
+#define FLISPY_POOL_H
+
+#include <stdatomic.h>
+
+// A work-stealing thread pool
+//
+// Each worker has a deque of tasks. It pushes and takes its own at the
+// bottom, and when that runs dry steals from the top of another's, where
+// the oldest and so usually biggest pieces of work are. Threads outside the
+// pool share one more deque. A thread waiting on a group runs tasks while
+// it waits, so tasks can spawn and wait on groups of their own, and sleeps
+// once there are none left to run. Async tasks are queued apart and only
+// ever run by idle workers, so waiting never gets stuck behind one.
+//
+// FLISPY_THREADS sets how many threads do the work, counting the one that
+// waits. Workers are only started once there is something to give them.
+typedef struct {
+  atomic_int pending;
+} pool_group_t;
+
+void pool_init(void);
+int pool_threads(void);
+
+// Run fn(arg) on some thread, as part of g. With only one thread it runs
+// before this returns.
+void pool_spawn(pool_group_t* g, void (*fn)(void*), void* arg);
+
+// Run fn(arg) on a worker, which is started for it even with only one
+// thread, so the caller gets on with something else. It belongs to no
+// group: fn says when it is done itself.
+void pool_async(void (*fn)(void*), void* arg);
+
+// Return once every task spawned into g has finished
+void pool_wait(pool_group_t* g);
+
+// Return once *done is set, running group tasks meanwhile like pool_wait.
+// Whatever sets it must be an async task, whose end wakes the waiter.
+void pool_await(atomic_int* done);
+
+#endif
@@ -0,0 +1,425 @@
+#include <limits.h>
+#include <math.h>
+
+#include "vec.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VEC_X86 1
+#endif
+
+static int mul_overflow(long a, long b, long* r) {
+#ifdef __GNUC__
+  return __builtin_mul_overflow(a, b, r);
+#else
+  if (a != 0 && b != 0) {
+    if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a)
+              : (b > 0 ? a < LONG_MIN / b : a < LONG_MAX / b)) { return 1; }
+  }
+  *r = a * b;
+  return 0;
+#endif
+}
+
+// Plain versions
+//
+// Overflow is collected in the sign bit of ovf rather than branched on, so
+// compilers can vectorize these for whatever the build targets.
+static int arith_l_c(int op, long* r, const long* a, const long* b, size_t n) {
+  long ovf = 0;
+  switch (op) {
+    case VEC_ADD:
+      for (size_t i = 0; i < n; i++) {
+        long s = (long)((unsigned long)a[i] + (unsigned long)b[i]);
+        ovf |= (a[i] ^ s) & (b[i] ^ s);
+        r[i] = s;
+      }
+      break;
+    case VEC_SUB:
+      for (size_t i = 0; i < n; i++) {
+        long s = (long)((unsigned long)a[i] - (unsigned long)b[i]);
+        ovf |= (a[i] ^ b[i]) & (a[i] ^ s);
+        r[i] = s;
+      }
+      break;
+    case VEC_MUL:
+      for (size_t i = 0; i < n; i++) {
+        long s = 0;
+        ovf |= -(long)mul_overflow(a[i], b[i], &s);
+        r[i] = s;
+      }
+      break;
+    case VEC_DIV:
+    case VEC_MOD:
+      for (size_t i = 0; i < n; i++) {
+        if (b[i] == 0) { return VEC_DIV_ZERO; }
+      }
+      for (size_t i = 0; i < n; i++) {
+        if (b[i] == -1) {
+          ovf |= -(long)(op == VEC_DIV && a[i] == LONG_MIN);
+          r[i] = op == VEC_DIV && a[i] != LONG_MIN ? -a[i] : 0;
+        } else {
+          r[i] = op == VEC_DIV ? a[i] / b[i] : a[i] % b[i];
+        }
+      }
+      break;
+  }
+  return ovf < 0 ? VEC_OVERFLOW : VEC_OK;
+}
+
+static int arith_d_c(int op, double* r, const double* a, const double* b, size_t n) {
+  if (op == VEC_DIV || op == VEC_MOD) {
+    for (size_t i = 0; i < n; i++) {
+      if (b[i] == 0) { return VEC_DIV_ZERO; }
+    }
+  }
+  switch (op) {
+    case VEC_ADD: for (size_t i = 0; i < n; i++) { r[i] = a[i] + b[i]; } break;
+    case VEC_SUB: for (size_t i = 0; i < n; i++) { r[i] = a[i] - b[i]; } break;
+    case VEC_MUL: for (size_t i = 0; i < n; i++) { r[i] = a[i] * b[i]; } break;
+    case VEC_DIV: for (size_t i = 0; i < n; i++) { r[i] = a[i] / b[i]; } break;
+    case VEC_MOD: for (size_t i = 0; i < n; i++) { r[i] = fmod(a[i], b[i]); } break;
+  }
+  return VEC_OK;
+}
+
+static void cmp_l_c(int op, long* r, const long* a, const long* b, size_t n) {
+  switch (op) {
+    case VEC_LT: for (size_t i = 0; i < n; i++) { r[i] = a[i] < b[i]; } break;
+    case VEC_GT: for (size_t i = 0; i < n; i++) { r[i] = a[i] > b[i]; } break;
+    case VEC_LE: for (size_t i = 0; i < n; i++) { r[i] = a[i] <= b[i]; } break;
+    case VEC_GE: for (size_t i = 0; i < n; i++) { r[i] = a[i] >= b[i]; } break;
+  }
+}
+
+static void cmp_d_c(int op, long* r, const double* a, const double* b, size_t n) {
+  switch (op) {
+    case VEC_LT: for (size_t i = 0; i < n; i++) { r[i] = a[i] < b[i]; } break;
+    case VEC_GT: for (size_t i = 0; i < n; i++) { r[i] = a[i] > b[i]; } break;
+    case VEC_LE: for (size_t i = 0; i < n; i++) { r[i] = a[i] <= b[i]; } break;
+    case VEC_GE: for (size_t i = 0; i < n; i++) { r[i] = a[i] >= b[i]; } break;
+  }
+}
+
+static double dot_d_c(const double* a, const double* b, size_t n) {
+  double s = 0;
+  for (size_t i = 0; i < n; i++) { s += a[i] * b[i]; }
+  return s;
+}
+
+static long min_l_c(const long* a, size_t n) {
+  long m = a[0];
+  for (size_t i = 1; i < n; i++) { m = a[i] < m ? a[i] : m; }
+  return m;
+}
+
+static long max_l_c(const long* a, size_t n) {
+  long m = a[0];
+  for (size_t i = 1; i < n; i++) { m = a[i] > m ? a[i] : m; }
+  return m;
+}
+
+static double min_d_c(const double* a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; i++) { m = a[i] < m ? a[i] : m; }
+  return m;
+}
+
+static double max_d_c(const double* a, size_t n) {
+  double m = a[0];
+  for (size_t i = 1; i < n; i++) { m = a[i] > m ? a[i] : m; }
+  return m;
+}
+
+static int scan_l_c(long* r, const long* a, size_t n) {
+  long acc = 0, ovf = 0;
+  for (size_t i = 0; i < n; i++) {
+    long s = (long)((unsigned long)acc + (unsigned long)a[i]);
+    ovf |= (acc ^ s) & (a[i] ^ s);
+    r[i] = acc = s;
+  }
+  return ovf < 0 ? VEC_OVERFLOW : VEC_OK;
+}
+
+#ifdef VEC_X86
+// AVX2 versions
+//
+// Each handles whole vectors of four and leaves the rest to the plain
+// version. AVX2 has no 64 bit multiply, so products of longs stay scalar.
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static int arith_l_avx2(int op, long* r, const long* a, const long* b, size_t n) {
+  if (op != VEC_ADD && op != VEC_SUB) { return arith_l_c(op, r, a, b, n); }
+
+  __m256i ovf = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+    __m256i s;
+    if (op == VEC_ADD) {
+      s = _mm256_add_epi64(x, y);
+      ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, s), _mm256_xor_si256(y, s)));
+    } else {
+      s = _mm256_sub_epi64(x, y);
+      ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, s)));
+    }
+    _mm256_storeu_si256((__m256i*)(r + i), s);
+  }
+
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(ovf))) { return VEC_OVERFLOW; }
+  return arith_l_c(op, r + i, a + i, b + i, n - i);
+}
+
+AVX2 static int arith_d_avx2(int op, double* r, const double* a, const double* b, size_t n) {
+  if (op == VEC_MOD) { return arith_d_c(op, r, a, b, n); }
+
+  size_t i = 0;
+  if (op == VEC_DIV) {
+    __m256d zero = _mm256_setzero_pd();
+    __m256d hit = zero;
+    for (; i + 4 <= n; i += 4) {
+      hit = _mm256_or_pd(hit, _mm256_cmp_pd(_mm256_loadu_pd(b + i), zero, _CMP_EQ_OQ));
+    }
+    if (_mm256_movemask_pd(hit)) { return VEC_DIV_ZERO; }
+    for (; i < n; i++) {
+      if (b[i] == 0) { return VEC_DIV_ZERO; }
+    }
+    i = 0;
+  }
+
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d y = _mm256_loadu_pd(b + i);
+    __m256d s;
+    switch (op) {
+      case VEC_ADD: s = _mm256_add_pd(x, y); break;
+      case VEC_SUB: s = _mm256_sub_pd(x, y); break;
+      case VEC_MUL: s = _mm256_mul_pd(x, y); break;
+      default: s = _mm256_div_pd(x, y); break;
+    }
+    _mm256_storeu_pd(r + i, s);
+  }
+  return arith_d_c(op, r + i, a + i, b + i, n - i);
+}
+
+AVX2 static void cmp_l_avx2(int op, long* r, const long* a, const long* b, size_t n) {
+  __m256i one = _mm256_set1_epi64x(1);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+    __m256i m;
+    switch (op) {
+      case VEC_LT: m = _mm256_and_si256(_mm256_cmpgt_epi64(y, x), one); break;
+      case VEC_GT: m = _mm256_and_si256(_mm256_cmpgt_epi64(x, y), one); break;
+      case VEC_LE: m = _mm256_andnot_si256(_mm256_cmpgt_epi64(x, y), one); break;
+      default: m = _mm256_andnot_si256(_mm256_cmpgt_epi64(y, x), one); break;
+    }
+    _mm256_storeu_si256((__m256i*)(r + i), m);
+  }
+  cmp_l_c(op, r + i, a + i, b + i, n - i);
+}
+
+AVX2 static void cmp_d_avx2(int op, long* r, const double* a, const double* b, size_t n) {
+  __m256i one = _mm256_set1_epi64x(1);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d y = _mm256_loadu_pd(b + i);
+    __m256d m;
+    switch (op) {
+      case VEC_LT: m = _mm256_cmp_pd(x, y, _CMP_LT_OQ); break;
+      case VEC_GT: m = _mm256_cmp_pd(x, y, _CMP_GT_OQ); break;
+      case VEC_LE: m = _mm256_cmp_pd(x, y, _CMP_LE_OQ); break;
+      default: m = _mm256_cmp_pd(x, y, _CMP_GE_OQ); break;
+    }
+    _mm256_storeu_si256((__m256i*)(r + i), _mm256_and_si256(_mm256_castpd_si256(m), one));
+  }
+  cmp_d_c(op, r + i, a + i, b + i, n - i);
+}
+
+// Eight running sums, added together at the end
+AVX2 static double dot_d_avx2(const double* a, const double* b, size_t n) {
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + dot_d_c(a + i, b + i, n - i);
+}
+
+AVX2 static long min_l_avx2(const long* a, size_t n) {
+  if (n < 4) { return min_l_c(a, n); }
+  __m256i m = _mm256_loadu_si256((const __m256i*)a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+  }
+
+  long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  long r = min_l_c(lanes, 4);
+  if (i < n) {
+    long t = min_l_c(a + i, n - i);
+    r = t < r ? t : r;
+  }
+  return r;
+}
+
+AVX2 static long max_l_avx2(const long* a, size_t n) {
+  if (n < 4) { return max_l_c(a, n); }
+  __m256i m = _mm256_loadu_si256((const __m256i*)a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(x, m));
+  }
+
+  long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  long r = max_l_c(lanes, 4);
+  if (i < n) {
+    long t = max_l_c(a + i, n - i);
+    r = t > r ? t : r;
+  }
+  return r;
+}
+
+AVX2 static double min_d_avx2(const double* a, size_t n) {
+  if (n < 4) { return min_d_c(a, n); }
+  __m256d m = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) { m = _mm256_min_pd(_mm256_loadu_pd(a + i), m); }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double r = min_d_c(lanes, 4);
+  if (i < n) {
+    double t = min_d_c(a + i, n - i);
+    r = t < r ? t : r;
+  }
+  return r;
+}
+
+AVX2 static double max_d_avx2(const double* a, size_t n) {
+  if (n < 4) { return max_d_c(a, n); }
+  __m256d m = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= n; i += 4) { m = _mm256_max_pd(_mm256_loadu_pd(a + i), m); }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double r = max_d_c(lanes, 4);
+  if (i < n) {
+    double t = max_d_c(a + i, n - i);
+    r = t > r ? t : r;
+  }
+  return r;
+}
+
+// Prefix sums of four lanes in two shifted adds, then the running total of
+// earlier blocks is added to all of them. The shifted adds sum pairs that
+// are not prefixes, which can overflow when the prefixes don't, so any
+// overflow is settled by redoing the work in order.
+AVX2 static int scan_l_avx2(long* r, const long* a, size_t n) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i carry = zero, ovf = zero;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i y = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+    __m256i s = _mm256_add_epi64(x, y);
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, s), _mm256_xor_si256(y, s)));
+
+    x = s;
+    y = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0f);
+    s = _mm256_add_epi64(x, y);
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, s), _mm256_xor_si256(y, s)));
+
+    x = s;
+    s = _mm256_add_epi64(x, carry);
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(x, s), _mm256_xor_si256(carry, s)));
+
+    _mm256_storeu_si256((__m256i*)(r + i), s);
+    carry = _mm256_permute4x64_epi64(s, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(ovf))) { return scan_l_c(r, a, n); }
+
+  long acc = i ? r[i - 1] : 0;
+  long ovs = 0;
+  for (; i < n; i++) {
+    long s = (long)((unsigned long)acc + (unsigned long)a[i]);
+    ovs |= (acc ^ s) & (a[i] ^ s);
+    r[i] = acc = s;
+  }
+  return ovs < 0 ? VEC_OVERFLOW : VEC_OK;
+}
+#endif
+
+// Dispatch
+static int (*arith_l)(int, long*, const long*, const long*, size_t) = arith_l_c;
+static int (*arith_d)(int, double*, const double*, const double*, size_t) = arith_d_c;
+static void (*cmp_l)(int, long*, const long*, const long*, size_t) = cmp_l_c;
+static void (*cmp_d)(int, long*, const double*, const double*, size_t) = cmp_d_c;
+static double (*dot_d)(const double*, const double*, size_t) = dot_d_c;
+static long (*min_l)(const long*, size_t) = min_l_c;
+static long (*max_l)(const long*, size_t) = max_l_c;
+static double (*min_d)(const double*, size_t) = min_d_c;
+static double (*max_d)(const double*, size_t) = max_d_c;
+static int (*scan_l)(long*, const long*, size_t) = scan_l_c;
+
+void vec_init(void) {
+#ifdef VEC_X86
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2")) { return; }
+  arith_l = arith_l_avx2;
+  arith_d = arith_d_avx2;
+  cmp_l = cmp_l_avx2;
+  cmp_d = cmp_d_avx2;
+  dot_d = dot_d_avx2;
+  min_l = min_l_avx2;
+  max_l = max_l_avx2;
+  min_d = min_d_avx2;
+  max_d = max_d_avx2;
+  scan_l = scan_l_avx2;
+#endif
+}
+
+int vec_arith_l(int op, long* r, const long* a, const long* b, size_t n) { return arith_l(op, r, a, b, n); }
+int vec_arith_d(int op, double* r, const double* a, const double* b, size_t n) { return arith_d(op, r, a, b, n); }
+void vec_cmp_l(int op, long* r, const long* a, const long* b, size_t n) { cmp_l(op, r, a, b, n); }
+void vec_cmp_d(int op, long* r, const double* a, const double* b, size_t n) { cmp_d(op, r, a, b, n); }
+double vec_dot_d(const double* a, const double* b, size_t n) { return dot_d(a, b, n); }
+long vec_min_l(const long* a, size_t n) { return min_l(a, n); }
+long vec_max_l(const long* a, size_t n) { return max_l(a, n); }
+double vec_min_d(const double* a, size_t n) { return min_d(a, n); }
+double vec_max_d(const double* a, size_t n) { return max_d(a, n); }
+int vec_scan_l(long* r, const long* a, size_t n) { return scan_l(r, a, n); }
+
+// Products of longs overflow too easily for lanes to pay off
+int vec_dot_l(const long* a, const long* b, size_t n, long* out) {
+  long acc = 0;
+  for (size_t i = 0; i < n; i++) {
+    long p;
+    if (mul_overflow(a[i], b[i], &p)) { return VEC_OVERFLOW; }
+    long s = (long)((unsigned long)acc + (unsigned long)p);
+    if (((acc ^ s) & (p ^ s)) < 0) { return VEC_OVERFLOW; }
+    acc = s;
+  }
+  *out = acc;
+  return VEC_OK;
+}
+
+// Each total depends on the one before, and adding in any other order
+// would round differently from a left to right fold
+void vec_scan_d(double* r, const double* a, size_t n) {
+  double acc = 0;
+  for (size_t i = 0; i < n; i++) { r[i] = acc += a[i]; }
+}
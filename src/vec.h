@@ -0,0 +1,39 @@
+#ifndef FLISPY_VEC_H
+#define FLISPY_VEC_H
+
+#include <stddef.h>
+
+// Kernels over contiguous arrays of longs or doubles
+//
+// Each has a plain C version and, on x86-64, an AVX2 one that vec_init
+// switches to when the CPU has it. Results may be written over either
+// argument. Kernels on longs that can overflow return VEC_OVERFLOW instead
+// of wrapping.
+enum { VEC_ADD, VEC_SUB, VEC_MUL, VEC_DIV, VEC_MOD };
+enum { VEC_LT, VEC_GT, VEC_LE, VEC_GE };
+enum { VEC_OK, VEC_OVERFLOW, VEC_DIV_ZERO };
+
+void vec_init(void);
+
+// Elementwise r = a op b
+int vec_arith_l(int op, long* r, const long* a, const long* b, size_t n);
+int vec_arith_d(int op, double* r, const double* a, const double* b, size_t n);
+
+// Elementwise r = a op b as 1 or 0
+void vec_cmp_l(int op, long* r, const long* a, const long* b, size_t n);
+void vec_cmp_d(int op, long* r, const double* a, const double* b, size_t n);
+
+int vec_dot_l(const long* a, const long* b, size_t n, long* out);
+double vec_dot_d(const double* a, const double* b, size_t n);
+
+// Smallest or largest of n > 0 elements
+long vec_min_l(const long* a, size_t n);
+long vec_max_l(const long* a, size_t n);
+double vec_min_d(const double* a, size_t n);
+double vec_max_d(const double* a, size_t n);
+
+// Running totals, r[i] = a[0] + ... + a[i]
+int vec_scan_l(long* r, const long* a, size_t n);
+void vec_scan_d(double* r, const double* a, size_t n);
+
+#endif
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/flispy.h"
+
+// Evaluate each line of stdin and print its value, as the REPL does
+int main(void) {
+  static char line[1 << 16];
+  flispy_ctx_t* ctx = flispy_new();
+
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\n")] = '\0';
+    flispy_println(flispy_eval(ctx, line, strlen(line)));
+  }
+
+  flispy_free(ctx);
+  return 0;
+}